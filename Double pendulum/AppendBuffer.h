@@ -0,0 +1,109 @@
+﻿#pragma once
+#include <algorithm>
+#include <atomic>
+#include <vector>
+
+// -------- lock-free append-only buffer --------
+// Any number of threads push() concurrently; a slot is claimed with one
+// fetch_add, so there is no lock and no allocation on the hot path. Pushes past
+// the capacity are counted in dropped() instead of growing the storage. Read
+// and clear() only while no thread is pushing (e.g. after parallelFor returns).
+// Which pushes fit once the buffer overflows depends on how the threads raced;
+// dropOverflowFrom() turns that into a reproducible result.
+template <typename T>
+class AppendBuffer
+{
+public:
+    explicit AppendBuffer(size_t capacity = 0) { reserve(capacity); }
+
+    AppendBuffer(const AppendBuffer& other) { *this = other; }
+
+    AppendBuffer& operator=(const AppendBuffer& other)
+    {
+        items = other.items;
+        used.store(other.used.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        lost.store(other.lost.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        return *this;
+    }
+
+    // drops the contents
+    void reserve(size_t capacity)
+    {
+        items.resize(capacity);
+        clear();
+    }
+
+    bool push(const T& item)
+    {
+        size_t i = used.fetch_add(1, std::memory_order_relaxed);
+        if (i >= items.size())
+        {
+            lost.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        items[i] = item;
+        return true;
+    }
+
+    size_t size() const
+    {
+        size_t n = used.load(std::memory_order_relaxed);
+        return n < items.size() ? n : items.size();
+    }
+
+    size_t capacity() const { return items.size(); }
+    size_t dropped() const { return lost.load(std::memory_order_relaxed); }
+
+    const T* data() const { return items.data(); }
+    const T& operator[](size_t i) const { return items[i]; }
+    const T* begin() const { return items.data(); }
+    const T* end() const { return items.data() + size(); }
+
+    // when the items pushed since size() was `first` did not all fit, drop the
+    // ones that did too and count them in dropped(): which ones those were
+    // depends on the thread timing, keeping none of them does not
+    void dropOverflowFrom(size_t first)
+    {
+        if (used.load(std::memory_order_relaxed) <= items.size() || first >= items.size()) return;
+        lost.fetch_add(items.size() - first, std::memory_order_relaxed);
+        used.store(first, std::memory_order_relaxed);
+    }
+
+    // sort the items pushed since size() was `first`: concurrent pushes land
+    // in whatever order the threads ran, this makes the order reproducible
+    template <typename Less>
+    void sortFrom(size_t first, Less less)
+    {
+        if (first < size()) std::sort(items.begin() + first, items.begin() + size(), less);
+    }
+
+    void clear()
+    {
+        used.store(0, std::memory_order_relaxed);
+        lost.store(0, std::memory_order_relaxed);
+    }
+
+    // checkpoint.h archive: capacity, counters and the stored items. Reading
+    // keeps this buffer's capacity (the owner reserves it first, the same way
+    // it did when saving) and rejects a file that stored a different one.
+    template <typename A>
+    void serialize(A& ar)
+    {
+        size_t cap = capacity(), n = size(), lostCount = dropped();
+        ar.io(cap); ar.io(n); ar.io(lostCount);
+        if constexpr (A::reading)
+        {
+            ar.check(cap == capacity() && n <= cap && ar.template fits<T>(n));
+            if (!ar.ok()) n = lostCount = 0;
+            clear();
+            used.store(n, std::memory_order_relaxed);
+            lost.store(lostCount, std::memory_order_relaxed);
+        }
+        ar.array(items.data(), n);
+    }
+
+private:
+    std::vector<T> items;
+    std::atomic<size_t> used{ 0 };
+    std::atomic<size_t> lost{ 0 };
+};
@@ -0,0 +1,378 @@
+﻿#pragma once
+#include <GLFW/glfw3.h>
+#include <vector>
+#include <math.h>
+#include "PendulumEnsemble.h"
+#include "SimdMath.h"
+
+// -------- N-link pendulum chains --------
+// Point masses on massless rods, like the double pendulum, with any number of
+// links. Angles are absolute (from the vertical) exactly as in Pendulum, so a
+// 2-link chain follows the same equations as stepRK4().
+//
+// Accelerations come from the articulated-body algorithm (Featherstone,
+// "Rigid Body Dynamics Algorithms", ch. 7): three sweeps along the chain,
+// O(N) per evaluation, instead of assembling and solving the N x N mass matrix
+// (O(N^3)). Everything is planar and expressed in world coordinates at the
+// pivot, so there are no frame transforms between links:
+//   motion vectors (w, vx, vy), force vectors (n, fx, fy)
+//   joint k turns about the previous bob P: S = (1, P.y, -P.x)
+//   gravity is applied as a base acceleration (0, 0, g)
+// with bob k at P + l (sin(theta), -cos(theta)) and g > 0 pulling towards -y.
+
+// per-link working arrays for one batch of V::width chains
+template <typename V>
+struct ChainScratch
+{
+    std::vector<V> sx, sy;                      // joint axes (S = (1, sx, sy))
+    std::vector<V> cx, cy;                      // velocity-product accelerations
+    std::vector<V> iww, iwx, iwy, ixx, ixy, iyy; // articulated inertias
+    std::vector<V> pw, pX, pY;                  // articulated bias forces
+    std::vector<V> uw, ux, uy, d, u;            // U = I S, D = S.U, u = -S.p
+    // RK4 stages
+    std::vector<V> th, w, kth, kw, acc, sumTh, sumW;
+
+    void resize(int links)
+    {
+        for (std::vector<V>* a : { &sx, &sy, &cx, &cy,
+            &iww, &iwx, &iwy, &ixx, &ixy, &iyy, &pw, &pX, &pY,
+            &uw, &ux, &uy, &d, &u, &th, &w, &kth, &kw, &acc, &sumTh, &sumW })
+            a->resize(links);
+    }
+};
+
+// absolute angular accelerations of V::width chains
+template <typename V>
+inline void chainAccelerations(int links, const V* theta, const V* omega, V* alpha,
+    const float* length, const float* mass, float gravity, ChainScratch<V>& s)
+{
+    // ---- outward: positions, joint axes, velocities, bias terms ----
+    V qx(0.0f), qy(0.0f);               // previous bob, the pivot first
+    V vw(0.0f), vx(0.0f), vy(0.0f);     // spatial velocity of the previous body
+    V prevOmega(0.0f);
+    for (int k = 0; k < links; k++)
+    {
+        V sn, cs;
+        simd::sincos(theta[k], sn, cs);
+        V sxk = qy, syk = -qx;
+        V rate = omega[k] - prevOmega;  // joint rate
+        prevOmega = omega[k];
+
+        // v = v_parent + S * rate, c = v x (S * rate)
+        vw = vw + rate;
+        vx = vx + sxk * rate;
+        vy = vy + syk * rate;
+        s.cx[k] = rate * (vy - vw * syk);
+        s.cy[k] = rate * (vw * sxk - vx);
+
+        qx = qx + V(length[k]) * sn;
+        qy = qy - V(length[k]) * cs;
+        s.sx[k] = sxk; s.sy[k] = syk;
+
+        // point mass at q: rigid inertia and bias force v x* (I v)
+        V m(mass[k]);
+        V mqx = m * qx, mqy = m * qy;
+        s.iww[k] = mqx * qx + mqy * qy;
+        s.iwx[k] = -mqy;
+        s.iwy[k] = mqx;
+        s.ixx[k] = m;
+        s.ixy[k] = V(0.0f);
+        s.iyy[k] = m;
+
+        V hx = m * vx - mqy * vw;
+        V hy = m * vy + mqx * vw;
+        s.pw[k] = vx * hy - vy * hx;
+        s.pX[k] = -(vw * hy);
+        s.pY[k] = vw * hx;
+    }
+
+    // ---- inward: articulated inertias and bias forces ----
+    for (int k = links - 1; k >= 0; k--)
+    {
+        V sxk = s.sx[k], syk = s.sy[k];
+        V Uw = s.iww[k] + s.iwx[k] * sxk + s.iwy[k] * syk;
+        V Ux = s.iwx[k] + s.ixx[k] * sxk + s.ixy[k] * syk;
+        V Uy = s.iwy[k] + s.ixy[k] * sxk + s.iyy[k] * syk;
+        V D = Uw + sxk * Ux + syk * Uy;
+        V uk = -(s.pw[k] + sxk * s.pX[k] + syk * s.pY[k]);
+        s.uw[k] = Uw; s.ux[k] = Ux; s.uy[k] = Uy;
+        s.d[k] = D; s.u[k] = uk;
+        if (k == 0) break;
+
+        // Ia = IA - U U^T / D, pa = pA + Ia c + U u / D, added to the parent
+        V invD = V(1.0f) / D;
+        V aw = Uw * invD, ax = Ux * invD, ay = Uy * invD;
+        V iww = s.iww[k] - aw * Uw, iwx = s.iwx[k] - aw * Ux, iwy = s.iwy[k] - aw * Uy;
+        V ixx = s.ixx[k] - ax * Ux, ixy = s.ixy[k] - ax * Uy, iyy = s.iyy[k] - ay * Uy;
+        V ck = s.cx[k], cl = s.cy[k];
+        V uD = uk * invD;
+
+        s.iww[k - 1] = s.iww[k - 1] + iww;
+        s.iwx[k - 1] = s.iwx[k - 1] + iwx;
+        s.iwy[k - 1] = s.iwy[k - 1] + iwy;
+        s.ixx[k - 1] = s.ixx[k - 1] + ixx;
+        s.ixy[k - 1] = s.ixy[k - 1] + ixy;
+        s.iyy[k - 1] = s.iyy[k - 1] + iyy;
+        s.pw[k - 1] = s.pw[k - 1] + s.pw[k] + iwx * ck + iwy * cl + Uw * uD;
+        s.pX[k - 1] = s.pX[k - 1] + s.pX[k] + ixx * ck + ixy * cl + Ux * uD;
+        s.pY[k - 1] = s.pY[k - 1] + s.pY[k] + ixy * ck + iyy * cl + Uy * uD;
+    }
+
+    // ---- outward: joint accelerations ----
+    V aw(0.0f), ax(0.0f), ay(gravity);
+    V prevAlpha(0.0f);
+    for (int k = 0; k < links; k++)
+    {
+        V bx = ax + s.cx[k], by = ay + s.cy[k];
+        V qdd = (s.u[k] - (s.uw[k] * aw + s.ux[k] * bx + s.uy[k] * by)) / s.d[k];
+        aw = aw + qdd;
+        ax = bx + s.sx[k] * qdd;
+        ay = by + s.sy[k] * qdd;
+        prevAlpha = prevAlpha + qdd;
+        alpha[k] = prevAlpha;
+    }
+}
+
+// -------- ensemble of chains --------
+// Columns are link-major: link k of chain i is at k * stride + i, so one
+// simd::vfloat load fetches the same link of V::width neighbouring chains and
+// the whole solver runs across chains. stride is the chain count rounded up
+// to a cache line.
+class ChainEnsemble
+{
+public:
+    static const int MAX_LINKS = 1000;
+    static const int LANES = 16;    // stride granularity, a multiple of every SIMD width
+
+    AlignedArray<float> theta;
+    AlignedArray<float> omega;
+    AlignedArray<float> prevTheta;
+
+    AlignedArray<float> colorR;
+    AlignedArray<float> colorG;
+    AlignedArray<float> colorB;
+
+    // tracks the last bob of every chain
+    TrailBuffer trails;
+
+    int size() const { return count; }
+    int linkCount() const { return links; }
+
+    void resize(int chains, int linksPerChain)
+    {
+        count = chains;
+        links = linksPerChain < 1 ? 1 : (linksPerChain > MAX_LINKS ? MAX_LINKS : linksPerChain);
+        stride = (chains + LANES - 1) / LANES * LANES;
+        theta.resize(0); omega.resize(0); prevTheta.resize(0);
+        theta.resize((size_t)links * stride);
+        omega.resize((size_t)links * stride);
+        prevTheta.resize((size_t)links * stride);
+        colorR.resize(chains); colorG.resize(chains); colorB.resize(chains);
+        trails.reset(chains);
+    }
+
+    // the first link starts at initial_theta1, every other one at initial_theta2
+    void set(int i, float initial_theta1, float initial_theta2, float hue)
+    {
+        for (int k = 0; k < links; k++)
+        {
+            float a = k == 0 ? initial_theta1 : initial_theta2;
+            at(theta, i, k) = a;
+            at(prevTheta, i, k) = a;
+            at(omega, i, k) = 0.0f;
+        }
+        // the colours are checkpointed, so they take the pinned sin too
+        colorR[i] = fabsf(simd::scalarSin(hue));
+        colorG[i] = fabsf(simd::scalarSin(hue + 2.1f));
+        colorB[i] = fabsf(simd::scalarSin(hue + 4.2f));
+    }
+
+    // Link lengths and masses run linearly from (l1, m1) to (l2, m2) and are
+    // then scaled to a total length of l1 + l2 and a total mass of m1 + m2,
+    // so two links are exactly the double pendulum.
+    void linkParameters(const SimParams& params, float* length, float* mass) const
+    {
+        float totalL = 0.0f, totalM = 0.0f;
+        for (int k = 0; k < links; k++)
+        {
+            float t = links > 1 ? (float)k / (links - 1) : 0.0f;
+            length[k] = params.l1 + t * (params.l2 - params.l1);
+            mass[k] = params.m1 + t * (params.m2 - params.m1);
+            totalL += length[k];
+            totalM += mass[k];
+        }
+        float scaleL = links > 1 ? (params.l1 + params.l2) / totalL : 1.0f;
+        float scaleM = links > 1 ? (params.m1 + params.m2) / totalM : 1.0f;
+        for (int k = 0; k < links; k++)
+        {
+            length[k] *= scaleL;
+            mass[k] *= scaleM;
+        }
+    }
+
+    // `steps` RK4 steps of size dt, simd::vfloat::width chains at a time
+    void step(SimParams params, float dt, int steps, ThreadPool& pool)
+    {
+        typedef simd::vfloat V;
+
+        std::vector<float> length(links), mass(links);
+        linkParameters(params, length.data(), mass.data());
+
+        // aim for about PendulumEnsemble::CHUNK links per pool chunk
+        int grain = PendulumEnsemble<float>::CHUNK / links;
+        grain = (grain + V::width - 1) / V::width * V::width;
+        if (grain < V::width) grain = V::width;
+
+        pool.parallelFor(stride, grain, [&](int begin, int end) {
+            ChainScratch<V> s;
+            s.resize(links);
+            for (int i = begin; i < end; i += V::width)
+            {
+                for (int k = 0; k < links; k++)
+                {
+                    s.th[k] = V::load(theta.data() + (size_t)k * stride + i);
+                    s.w[k] = V::load(omega.data() + (size_t)k * stride + i);
+                }
+                for (int n = 0; n < steps; n++)
+                    stepRK4(s, dt, length.data(), mass.data(), params.gravity);
+                for (int k = 0; k < links; k++)
+                {
+                    s.th[k].store(theta.data() + (size_t)k * stride + i);
+                    s.w[k].store(omega.data() + (size_t)k * stride + i);
+                }
+            }
+            });
+    }
+
+    template <typename A>
+    void serialize(A& ar)
+    {
+        int n = count, k = links;
+        ar.io(n); ar.io(k);
+        if constexpr (A::reading)
+        {
+            ar.check(n >= 0 && k >= 1 && k <= MAX_LINKS && ar.template fits<float>((size_t)n * k * 3));
+            if (!ar.ok()) n = 0;
+            resize(n, k);
+        }
+        ar.array(theta.data(), theta.size());
+        ar.array(omega.data(), omega.size());
+        ar.array(prevTheta.data(), prevTheta.size());
+        ar.array(colorR.data(), count); ar.array(colorG.data(), count); ar.array(colorB.data(), count);
+        trails.serialize(ar);
+        if constexpr (A::reading)
+            ar.check(trails.members() == count);
+    }
+
+    void storePrevious()
+    {
+        memcpy(prevTheta.data(), theta.data(), theta.size() * sizeof(float));
+    }
+
+    // append the interpolated last-bob positions to the trails
+    void updateTrails(float cx, float cy, float alpha, const SimParams& params)
+    {
+        std::vector<float> length(links), mass(links);
+        linkParameters(params, length.data(), mass.data());
+
+        TrailBuffer::TrailPoint* out = trails.slot();
+        for (int i = 0; i < count; i++)
+        {
+            float x = cx, y = cy;
+            for (int k = 0; k < links; k++)
+            {
+                float a = renderAngle(i, k, alpha);
+                x += length[k] * sinf(a);
+                y -= length[k] * cosf(a);
+            }
+            out[i].x = x;
+            out[i].y = y;
+        }
+        trails.commit();
+    }
+
+    void draw(float cx, float cy, float alpha, const SimParams& params) const
+    {
+        std::vector<float> length(links), mass(links);
+        linkParameters(params, length.data(), mass.data());
+
+        for (int i = 0; i < count; i++)
+        {
+            if (g_showTrails)
+                trails.draw(i, colorR[i], colorG[i], colorB[i]);
+            if (!g_showPendulums) continue;
+
+            glColor3f(1, 1, 1);
+            glBegin(GL_LINE_STRIP);
+            float x = cx, y = cy;
+            glVertex2f(x, y);
+            for (int k = 0; k < links; k++)
+            {
+                float a = renderAngle(i, k, alpha);
+                x += length[k] * sinf(a);
+                y -= length[k] * cosf(a);
+                glVertex2f(x, y);
+            }
+            glEnd();
+        }
+    }
+
+private:
+    float& at(AlignedArray<float>& column, int i, int k) { return column[(size_t)k * stride + i]; }
+
+    float renderAngle(int i, int k, float alpha) const
+    {
+        size_t j = (size_t)k * stride + i;
+        return prevTheta[j] + alpha * (theta[j] - prevTheta[j]);
+    }
+
+    template <typename V>
+    static void stepRK4(ChainScratch<V>& s, float dt, const float* length, const float* mass, float gravity)
+    {
+        const int n = (int)s.th.size();
+        const V h(dt), half(0.5f * dt), sixth(dt / 6.0f), two(2.0f);
+        V* th = s.th.data();
+        V* w = s.w.data();
+        V* kth = s.kth.data();
+        V* kw = s.kw.data();
+        V* acc = s.acc.data();
+        V* sumTh = s.sumTh.data();
+        V* sumW = s.sumW.data();
+
+        // kth/kw hold the next stage state, sumTh/sumW the weighted slopes
+        chainAccelerations(n, th, w, kw, length, mass, gravity, s);
+        for (int k = 0; k < n; k++)
+        {
+            sumTh[k] = w[k];
+            sumW[k] = kw[k];
+            kth[k] = th[k] + half * w[k];
+            kw[k] = w[k] + half * kw[k];
+        }
+
+        for (int stage = 2; stage <= 4; stage++)
+        {
+            // slope at the stage state: d theta = kw, d omega = acc
+            chainAccelerations(n, kth, kw, acc, length, mass, gravity, s);
+            const V weight = stage == 4 ? V(1.0f) : two;
+            const V next = stage == 3 ? h : half;
+            for (int k = 0; k < n; k++)
+            {
+                V dth = kw[k], dw = acc[k];
+                sumTh[k] = sumTh[k] + weight * dth;
+                sumW[k] = sumW[k] + weight * dw;
+                kth[k] = th[k] + next * dth;
+                kw[k] = w[k] + next * dw;
+            }
+        }
+
+        for (int k = 0; k < n; k++)
+        {
+            th[k] = th[k] + sixth * sumTh[k];
+            w[k] = w[k] + sixth * sumW[k];
+        }
+    }
+
+    int count = 0;
+    int links = 2;
+    int stride = 0;
+};
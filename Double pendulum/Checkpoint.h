@@ -0,0 +1,321 @@
+﻿#pragma once
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+#if defined(__linux__)
+#include <fcntl.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+// -------- binary checkpoints --------
+// A checkpoint is a small header followed by whatever the caller's
+// serialize(ar) function writes. The same function reads it back: every
+// serializable class has
+//   template <typename A> void serialize(A& ar)
+// that calls ar.io(value) / ar.array(ptr, n) for its fields in a fixed order,
+// and checks A::reading where it must allocate first (Reader::fits() bounds
+// any size it reads before allocating). ar.version is the version of the
+// file being read (VERSION when writing), so fields added later are read
+// only from files that have them. Values are stored as
+// their raw bytes, so a checkpoint restores bit for bit on the same platform
+// and compiler; it is not meant to move between architectures.
+//
+// Saving never blocks on disk. On Linux the process forks and the child, which
+// sees a copy-on-write snapshot of memory, serializes straight to the file
+// and exits. Elsewhere the state is serialized into memory (a memcpy of the
+// columns) and a background thread writes it out.
+//
+// Version history:
+//   1  first version
+//   2  Lyapunov tangents and settings
+//   3  Poincare section settings
+//   4  winding counts and compensation carries of the ensembles
+//   5  per-member physical parameters
+//   6  initial condition generator settings
+//   7  parameters the Dormand-Prince stages were computed with
+//   8  count of dropped events
+namespace checkpoint
+{
+    const char MAGIC[4] = { 'D', 'P', 'C', 'K' };
+    const uint32_t VERSION = 8;
+
+    // ---- writing ----
+    template <typename Sink>
+    class Writer
+    {
+    public:
+        static const bool reading = false;
+        uint32_t version = VERSION;
+
+        explicit Writer(Sink& sink) : sink(sink) {}
+
+        template <typename T>
+        void io(T& value) { sink.put(&value, sizeof(T)); }
+
+        template <typename T>
+        void array(T* values, size_t n) { if (n) sink.put(values, n * sizeof(T)); }
+
+        bool ok() const { return sink.ok(); }
+
+    private:
+        Sink& sink;
+    };
+
+    // appends to a byte vector
+    class MemorySink
+    {
+    public:
+        std::vector<char> bytes;
+
+        void put(const void* p, size_t n)
+        {
+            const char* c = (const char*)p;
+            bytes.insert(bytes.end(), c, c + n);
+        }
+
+        bool ok() const { return true; }
+    };
+
+#if defined(__linux__)
+    // buffered write(2) on a file descriptor, no allocation (usable after fork)
+    class FileSink
+    {
+    public:
+        explicit FileSink(int fd) : fd(fd) {}
+
+        void put(const void* p, size_t n)
+        {
+            const char* c = (const char*)p;
+            while (n)
+            {
+                size_t take = n < sizeof(buffer) - used ? n : sizeof(buffer) - used;
+                memcpy(buffer + used, c, take);
+                used += take; c += take; n -= take;
+                if (used == sizeof(buffer)) flush();
+            }
+        }
+
+        void flush()
+        {
+            size_t done = 0;
+            while (done < used && good)
+            {
+                ssize_t w = ::write(fd, buffer + done, used - done);
+                if (w <= 0) good = false;
+                else done += (size_t)w;
+            }
+            used = 0;
+        }
+
+        bool ok() const { return good; }
+
+    private:
+        int fd;
+        bool good = true;
+        size_t used = 0;
+        char buffer[1 << 16];
+    };
+#endif
+
+    // ---- reading ----
+    class Reader
+    {
+    public:
+        static const bool reading = true;
+        uint32_t version = VERSION;    // set by header()
+
+        Reader(const char* data, size_t size) : data(data), size(size) {}
+
+        template <typename T>
+        void io(T& value) { get(&value, sizeof(T)); }
+
+        template <typename T>
+        void array(T* values, size_t n) { if (n) get(values, n * sizeof(T)); }
+
+        // reject a value that would make the caller allocate nonsense
+        void check(bool condition) { if (!condition) good = false; }
+
+        // whether n values of type T can still be in the file
+        template <typename T>
+        bool fits(size_t n) const { return n <= (size - pos) / sizeof(T); }
+
+        bool ok() const { return good; }
+        bool atEnd() const { return pos == size; }
+
+    private:
+        void get(void* p, size_t n)
+        {
+            if (!good || n > size - pos)
+            {
+                good = false;
+                memset(p, 0, n);
+                return;
+            }
+            memcpy(p, data + pos, n);
+            pos += n;
+        }
+
+        const char* data;
+        size_t size;
+        size_t pos = 0;
+        bool good = true;
+    };
+
+    template <typename A>
+    void header(A& ar)
+    {
+        char magic[4];
+        memcpy(magic, MAGIC, 4);
+        ar.array(magic, 4);
+        ar.io(ar.version);
+        if constexpr (A::reading)
+            ar.check(memcmp(magic, MAGIC, 4) == 0 && ar.version >= 1 && ar.version <= VERSION);
+    }
+
+    // read `path` and hand it to f(Reader&); false if the file is missing,
+    // not a checkpoint, of a newer version, truncated or has trailing bytes
+    template <typename F>
+    bool load(const char* path, F&& f)
+    {
+        FILE* file = fopen(path, "rb");
+        if (!file) return false;
+        std::vector<char> bytes;
+        char chunk[1 << 16];
+        size_t n;
+        while ((n = fread(chunk, 1, sizeof(chunk), file)) > 0)
+            bytes.insert(bytes.end(), chunk, chunk + n);
+        fclose(file);
+
+        Reader ar(bytes.data(), bytes.size());
+        header(ar);
+        if (!ar.ok()) return false;
+        f(ar);
+        return ar.ok() && ar.atEnd();
+    }
+
+    // ---- asynchronous saving ----
+    class AsyncSaver
+    {
+    public:
+        enum class Status { Idle, Saving, Saved, Failed };
+
+        ~AsyncSaver() { wait(); }
+
+        // start saving f(Writer&) to path; false if a save is still running
+        template <typename F>
+        bool save(const std::string& path, F&& f)
+        {
+            poll();
+            if (state == Status::Saving) return false;
+            target = path;
+            std::string temp = path + ".tmp";
+
+#if defined(__linux__)
+            pid_t pid = fork();
+            if (pid == 0)
+            {
+                // child: the memory image is frozen at the moment of the fork
+                int fd = ::open(temp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+                bool good = fd >= 0;
+                if (good)
+                {
+                    FileSink sink(fd);
+                    Writer<FileSink> ar(sink);
+                    header(ar);
+                    f(ar);
+                    sink.flush();
+                    good = sink.ok() && fsync(fd) == 0;
+                    good = ::close(fd) == 0 && good;
+                }
+                good = good && ::rename(temp.c_str(), path.c_str()) == 0;
+                _exit(good ? 0 : 1);
+            }
+            if (pid > 0)
+            {
+                child = pid;
+                state = Status::Saving;
+                return true;
+            }
+            // fork failed, fall through to the thread
+#endif
+            MemorySink sink;
+            Writer<MemorySink> ar(sink);
+            header(ar);
+            f(ar);
+
+            state = Status::Saving;
+            finished = false;
+            writer = std::thread([this, temp, bytes = std::move(sink.bytes)] {
+                FILE* file = fopen(temp.c_str(), "wb");
+                bool good = file && fwrite(bytes.data(), 1, bytes.size(), file) == bytes.size();
+                if (file) good = fclose(file) == 0 && good;
+                remove(target.c_str());
+                good = good && rename(temp.c_str(), target.c_str()) == 0;
+                succeeded = good;
+                finished = true;
+                });
+            return true;
+        }
+
+        // check on a running save, call once per frame
+        Status poll()
+        {
+            if (state != Status::Saving) return state;
+#if defined(__linux__)
+            if (child > 0)
+            {
+                int status = 0;
+                if (waitpid(child, &status, WNOHANG) == child)
+                {
+                    child = -1;
+                    state = WIFEXITED(status) && WEXITSTATUS(status) == 0 ? Status::Saved : Status::Failed;
+                }
+                return state;
+            }
+#endif
+            if (finished)
+            {
+                writer.join();
+                state = succeeded ? Status::Saved : Status::Failed;
+            }
+            return state;
+        }
+
+        // block until the running save is done
+        void wait()
+        {
+#if defined(__linux__)
+            if (child > 0)
+            {
+                int status = 0;
+                waitpid(child, &status, 0);
+                child = -1;
+                state = WIFEXITED(status) && WEXITSTATUS(status) == 0 ? Status::Saved : Status::Failed;
+            }
+#endif
+            if (writer.joinable())
+            {
+                writer.join();
+                state = succeeded ? Status::Saved : Status::Failed;
+            }
+        }
+
+        const std::string& path() const { return target; }
+
+    private:
+        Status state = Status::Idle;
+        std::string target;
+#if defined(__linux__)
+        pid_t child = -1;
+#endif
+        std::thread writer;
+        std::atomic<bool> finished{ false };
+        std::atomic<bool> succeeded{ false };
+    };
+}
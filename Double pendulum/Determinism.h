@@ -0,0 +1,308 @@
+﻿#pragma once
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <vector>
+#include "PendulumEnsemble.h"
+#include "ChainEnsemble.h"
+#include "Checkpoint.h"
+#include "InitialConditions.h"
+
+// -------- determinism self-check (--check-determinism) --------
+// Runs the same ensemble with 1, 2, 8 and 32 threads and, for the float SIMD
+// kernels, once more one lane at a time (simd::vfloat1), then compares the
+// final state, the retired members, every event and every Poincare section
+// crossing bit for bit, also when frames overflow the buffers. The thread
+// count must never change a result. The scalar run only has to match the
+// SIMD one in a SIMD_DETERMINISTIC build (SimdMath.h); elsewhere a
+// difference is reported but not counted as a failure. Each line ends with a hash of the
+// result, to compare builds and machines with each other; in a deterministic
+// build the float and double cases hash the same everywhere (long double
+// is left out, its format depends on the compiler).
+// The restart cases save a checkpoint halfway, restore it into a fresh
+// ensemble and finish the run there; the result must match the run that was
+// never stopped. A checkpoint with a corrupted buffer capacity must be
+// rejected.
+namespace determinism
+{
+    const int MEMBERS = 4 * PendulumEnsemble<float>::CHUNK + 3;    // several chunks and a ragged tail
+    const int CHAINS = 1000;
+    const int CHAIN_LINKS = 5;
+    const int FRAMES = 20;
+    const int STEPS_PER_FRAME = 10;
+    const int THREADS[] = { 1, 2, 8, 32 };
+    const int THREAD_RUNS = sizeof(THREADS) / sizeof(THREADS[0]);
+
+    // bytes of every event and section crossing seen on the way, then of the
+    // final state; with `sweep` m2/m1 runs from 0.1 to 10 over the members.
+    // After `restartFrame` frames the ensemble goes through a checkpoint in
+    // memory and a fresh one restored from it takes over. A `bufferCapacity`
+    // shrinks the event and section buffers and starts arm 2 moving slowly
+    // against its acceleration, so that every member turns around (an event
+    // and a section crossing) within the first two frames: 4096 items
+    // overflow the first and hold the second.
+    template <typename T>
+    std::vector<char> runEnsemble(Integrator method, bool scalar, ThreadPool& pool, int lyapunovInterval = 0,
+        bool sweep = false, int restartFrame = -1, size_t bufferCapacity = 0)
+    {
+        std::unique_ptr<PendulumEnsemble<T>> e(new PendulumEnsemble<T>());
+        e->resize(MEMBERS);
+        for (int i = 0; i < MEMBERS; i++)
+            e->set(i, T(0.5), T(2.0 + i * 1e-4), i * 0.007f);
+        e->eventMask = (1 << (int)EventKind::Count) - 1;
+        e->retireMask = eventBit(EventKind::Flip2);
+        e->energyInterval = 2 * STEPS_PER_FRAME;
+        e->scalarKernels = scalar;
+        e->lyapunovInterval = lyapunovInterval;
+        e->section.variable = 1;        // arm 2 through hanging, both ways
+        e->section.value = 3.141592653589793;
+        e->section.direction = 0;
+        if (bufferCapacity)
+        {
+            e->setAll(pool, [](int i, T* y, float& hue) {
+                y[0] = T(0.5); y[1] = T(2.0 + i * 1e-4);
+                y[2] = T(0); y[3] = T(-1e-5 * (i % 1000));
+                hue = i * 0.007f;
+                });
+            e->section.variable = 3;    // omega2 through zero
+            e->section.value = 0.0;
+            e->events.reserve(bufferCapacity);
+            e->sectionPoints.reserve(bufferCapacity);
+        }
+
+        SimParams params;
+        for (int i = 0; sweep && i < MEMBERS; i++)
+        {
+            SimParams own = params;
+            own.m2 = own.m1 * (0.1f + 9.9f * i / (MEMBERS - 1));
+            e->setParams(i, own);
+        }
+        checkpoint::MemorySink sink;
+        checkpoint::Writer<checkpoint::MemorySink> ar(sink);
+        for (int f = 0; f < FRAMES; f++)
+        {
+            if (f == restartFrame)
+            {
+                checkpoint::MemorySink saved;
+                checkpoint::Writer<checkpoint::MemorySink> out(saved);
+                checkpoint::header(out);
+                e->serialize(out);
+
+                // the kernel choice and the section are settings of the
+                // caller, not part of a checkpoint
+                std::unique_ptr<PendulumEnsemble<T>> restored(new PendulumEnsemble<T>());
+                restored->scalarKernels = scalar;
+                restored->section = e->section;
+                checkpoint::Reader in(saved.bytes.data(), saved.bytes.size());
+                checkpoint::header(in);
+                restored->serialize(in);
+                if (!in.ok() || !in.atEnd())
+                    return std::vector<char>();
+                e = std::move(restored);
+            }
+            e->step(params, T(0.01), STEPS_PER_FRAME, method, pool);
+            for (PendulumEvent ev : e->events)
+                ar.io(ev);
+            size_t dropped = e->events.dropped();
+            ar.io(dropped);
+            e->events.clear();
+            for (SectionPoint p : e->sectionPoints)
+            {
+                ar.io(p.time); ar.io(p.member);
+                ar.array(p.state, 4);
+            }
+            dropped = e->sectionPoints.dropped();
+            ar.io(dropped);
+            e->sectionPoints.clear();
+        }
+        e->serialize(ar);
+        return sink.bytes;
+    }
+
+    // the members every initial condition generator seeds on the pool
+    inline std::vector<char> runSeeding(ThreadPool& pool)
+    {
+        checkpoint::MemorySink sink;
+        checkpoint::Writer<checkpoint::MemorySink> ar(sink);
+        for (int g = 0; g < (int)initial::Generator::Count; g++)
+        {
+            initial::Settings s;
+            s.generator = (initial::Generator)g;
+            s.seed = 12345;
+            s.center[0] = 0.5f; s.center[1] = 2.0f;
+            s.spread[2] = s.spread[3] = 1.0f;
+            PendulumEnsemble<double> e;
+            e.resize(MEMBERS);
+            e.setAll(pool, [&](int i, double* y, float& hue) {
+                s.state(i, y);
+                hue = i * 0.007f;
+                });
+            e.serialize(ar);
+        }
+        return sink.bytes;
+    }
+
+    inline std::vector<char> runChains(ThreadPool& pool)
+    {
+        ChainEnsemble c;
+        c.resize(CHAINS, CHAIN_LINKS);
+        for (int i = 0; i < CHAINS; i++)
+            c.set(i, 0.5f, 2.0f + i * 1e-4f, i * 0.007f);
+
+        SimParams params;
+        for (int f = 0; f < FRAMES; f++)
+            c.step(params, 0.01f, STEPS_PER_FRAME, pool);
+        checkpoint::MemorySink sink;
+        checkpoint::Writer<checkpoint::MemorySink> ar(sink);
+        c.serialize(ar);
+        return sink.bytes;
+    }
+
+    // a checkpoint whose retired-member capacity is overwritten with a huge
+    // value; the reader must reject it instead of allocating what it says
+    inline bool rejectsCorruptCapacity(ThreadPool& pool)
+    {
+        PendulumEnsemble<float> e;
+        e.resize(MEMBERS);
+        for (int i = 0; i < MEMBERS; i++)
+            e.set(i, 0.5f, 2.0f + i * 1e-4f, i * 0.007f);
+        e.retireMask = eventBit(EventKind::Flip2);
+        SimParams params;
+        for (int f = 0; f < FRAMES; f++)
+            e.step(params, 0.01f, STEPS_PER_FRAME, Integrator::RK4, pool);
+
+        checkpoint::MemorySink saved;
+        checkpoint::Writer<checkpoint::MemorySink> out(saved);
+        checkpoint::header(out);
+        e.serialize(out);
+        checkpoint::MemorySink field;
+        checkpoint::Writer<checkpoint::MemorySink> fieldOut(field);
+        e.retired.serialize(fieldOut);
+        auto at = std::search(saved.bytes.begin(), saved.bytes.end(), field.bytes.begin(), field.bytes.end());
+        if (at == saved.bytes.end())
+            return false;
+        const size_t huge = ~size_t(0) >> 4;
+        memcpy(&*at, &huge, sizeof(huge));
+
+        PendulumEnsemble<float> restored;
+        checkpoint::Reader in(saved.bytes.data(), saved.bytes.size());
+        checkpoint::header(in);
+        restored.serialize(in);
+        return !in.ok();
+    }
+
+    // 64-bit FNV-1a
+    inline unsigned long long hash(const std::vector<char>& bytes)
+    {
+        unsigned long long h = 14695981039346656037ull;
+        for (char c : bytes)
+        {
+            h ^= (unsigned char)c;
+            h *= 1099511628211ull;
+        }
+        return h;
+    }
+
+    // prints one line per case to out, true when nothing that must match differs
+    inline bool check(FILE* out)
+    {
+        std::vector<std::unique_ptr<ThreadPool>> pools;
+        for (int threads : THREADS)
+            pools.emplace_back(new ThreadPool(threads));
+
+        fprintf(out, "SIMD width %d, FMA %s, %s build\n", simd::vfloat::width,
+            SIMD_FUSED ? "fused" : "not fused", SIMD_DETERMINISTIC ? "deterministic" : "default");
+
+        bool ok = true;
+        // run(pool, scalar) -> bytes; hasScalar adds the one-lane comparison
+        auto compare = [&](const char* name, bool hasScalar, auto&& run) {
+            fprintf(out, "%-28s threads", name);
+            const std::vector<char> reference = run(*pools[0], false);
+            bool same = true;
+            for (int t = 1; t < THREAD_RUNS; t++)
+                same = run(*pools[t], false) == reference && same;
+            fprintf(out, " %s", same ? "identical" : "DIFFER");
+            ok = ok && same;
+            if (hasScalar)
+            {
+                bool scalarSame = run(*pools[0], true) == reference;
+                fprintf(out, ", scalar vs SIMD %s", scalarSame ? "identical" : "DIFFER");
+                if (SIMD_DETERMINISTIC) ok = ok && scalarSame;
+            }
+            fprintf(out, "  %016llx\n", hash(reference));
+            };
+
+        auto ensemble = [&](Precision p, Integrator method) {
+            char name[64];
+            snprintf(name, sizeof(name), "%s %s", precisionName(p), integratorName(method));
+            if (p == Precision::Float)
+                compare(name, method == Integrator::RK4, [&](ThreadPool& pool, bool scalar) {
+                    return runEnsemble<float>(method, scalar, pool);
+                    });
+            else
+                compare(name, false, [&](ThreadPool& pool, bool) {
+                    return runEnsemble<double>(method, false, pool);
+                    });
+            };
+        ensemble(Precision::Float, Integrator::RK4);
+        ensemble(Precision::Float, Integrator::StormerVerlet);
+        ensemble(Precision::Float, Integrator::DormandPrince45);
+        ensemble(Precision::Double, Integrator::RK4);
+        ensemble(Precision::Double, Integrator::Yoshida4);
+        ensemble(Precision::Double, Integrator::Taylor);
+        compare("float RK4 Lyapunov", true, [&](ThreadPool& pool, bool scalar) {
+            return runEnsemble<float>(Integrator::RK4, scalar, pool, 7);
+            });
+        compare("double RK4 Lyapunov", false, [&](ThreadPool& pool, bool) {
+            return runEnsemble<double>(Integrator::RK4, false, pool, 7);
+            });
+        compare("double Yoshida 4 Lyapunov", false, [&](ThreadPool& pool, bool) {
+            return runEnsemble<double>(Integrator::Yoshida4, false, pool, 7);
+            });
+        compare("float RK4 sweep", true, [&](ThreadPool& pool, bool scalar) {
+            return runEnsemble<float>(Integrator::RK4, scalar, pool, 0, true);
+            });
+        compare("float RK4 Lyapunov sweep", true, [&](ThreadPool& pool, bool scalar) {
+            return runEnsemble<float>(Integrator::RK4, scalar, pool, 7, true);
+            });
+        compare("double Yoshida 4 sweep", false, [&](ThreadPool& pool, bool) {
+            return runEnsemble<double>(Integrator::Yoshida4, false, pool, 0, true);
+            });
+        compare("float RK4 buffer overflow", true, [&](ThreadPool& pool, bool scalar) {
+            return runEnsemble<float>(Integrator::RK4, scalar, pool, 0, false, -1, 4096);
+            });
+
+        // run(pool, restartFrame) -> bytes, stopped halfway or never
+        auto restart = [&](const char* name, auto&& run) {
+            fprintf(out, "%-28s restart", name);
+            ThreadPool& pool = *pools[THREAD_RUNS - 1];
+            const std::vector<char> reference = run(pool, -1);
+            bool same = run(pool, FRAMES / 2) == reference;
+            fprintf(out, " %s", same ? "identical" : "DIFFER");
+            ok = ok && same;
+            fprintf(out, "  %016llx\n", hash(reference));
+            };
+        restart("float RK4", [&](ThreadPool& pool, int frame) {
+            return runEnsemble<float>(Integrator::RK4, false, pool, 0, false, frame);
+            });
+        restart("float Dormand-Prince 4(5)", [&](ThreadPool& pool, int frame) {
+            return runEnsemble<float>(Integrator::DormandPrince45, false, pool, 0, false, frame);
+            });
+        restart("double Yoshida 4", [&](ThreadPool& pool, int frame) {
+            return runEnsemble<double>(Integrator::Yoshida4, false, pool, 0, false, frame);
+            });
+        restart("float RK4 Lyapunov sweep", [&](ThreadPool& pool, int frame) {
+            return runEnsemble<float>(Integrator::RK4, false, pool, 7, true, frame);
+            });
+        bool rejected = rejectsCorruptCapacity(*pools[THREAD_RUNS - 1]);
+        fprintf(out, "%-28s restart %s\n", "corrupt capacity", rejected ? "rejected" : "ACCEPTED");
+        ok = ok && rejected;
+
+        compare("seeding (all generators)", false, [&](ThreadPool& pool, bool) { return runSeeding(pool); });
+        compare("float chains (5 links)", false, [&](ThreadPool& pool, bool) { return runChains(pool); });
+
+        fprintf(out, ok ? "Deterministic\n" : "NOT deterministic\n");
+        return ok;
+    }
+}
@@ -0,0 +1,166 @@
+﻿#pragma once
+#include <math.h>
+#include <cmath>
+#include "Pendulum.h"
+
+// -------- adaptive Dormand-Prince 5(4) --------
+// Each trajectory keeps its own step size and runs ahead of the frame clock;
+// the frame state is read from the 4th order continuous extension of the last
+// accepted step (Hairer, Norsett & Wanner, "Solving ODEs I", DOPRI5/CONTD5).
+// State vectors are ordered { theta1, theta2, omega1, omega2 }.
+
+// per-trajectory integrator state
+template <typename T>
+struct AdaptiveState
+{
+    T y[4];         // state at the end of the last accepted step
+    T k1[4];        // derivative at y (first-same-as-last)
+    T rcont[5][4];  // dense output coefficients of the last accepted step
+    T h;            // next step size to try (signed)
+    T hLast;        // size of the last accepted step
+    T lead;         // integrator time minus frame time, always in [0, |hLast|] * sign(h)
+};
+
+template <typename T>
+struct DormandPrince45
+{
+    BasicPendulumConsts<T> k;
+    double rtol;
+    double atol;
+
+    // give up refining below this fraction of the requested span
+    static constexpr double MIN_STEP_FRACTION = 1e-6;
+
+    void derivative(const T* y, T* dy) const
+    {
+        accelerations(y[0], y[1], y[2], y[3], k, dy[2], dy[3]);
+        dy[0] = y[2];
+        dy[1] = y[3];
+    }
+
+    void start(AdaptiveState<T>& s, const T* y, T h) const
+    {
+        for (int j = 0; j < 4; j++)
+        {
+            s.y[j] = y[j];
+            for (int r = 0; r < 5; r++) s.rcont[r][j] = T(0);
+        }
+        s.rcont[0][0] = y[0]; s.rcont[0][1] = y[1];
+        s.rcont[0][2] = y[2]; s.rcont[0][3] = y[3];
+        derivative(y, s.k1);
+        s.h = h;
+        s.hLast = T(0);
+        s.lead = T(0);
+    }
+
+    // try one step of size s.h; on success (or when forced) advance s and return true
+    bool tryStep(AdaptiveState<T>& s, bool force = false) const
+    {
+        static const T
+            a21 = T(1) / 5,
+            a31 = T(3) / 40, a32 = T(9) / 40,
+            a41 = T(44) / 45, a42 = T(-56) / 15, a43 = T(32) / 9,
+            a51 = T(19372) / 6561, a52 = T(-25360) / 2187, a53 = T(64448) / 6561, a54 = T(-212) / 729,
+            a61 = T(9017) / 3168, a62 = T(-355) / 33, a63 = T(46732) / 5247, a64 = T(49) / 176, a65 = T(-5103) / 18656,
+            a71 = T(35) / 384, a73 = T(500) / 1113, a74 = T(125) / 192, a75 = T(-2187) / 6784, a76 = T(11) / 84,
+            e1 = T(71) / 57600, e3 = T(-71) / 16695, e4 = T(71) / 1920, e5 = T(-17253) / 339200, e6 = T(22) / 525, e7 = T(-1) / 40,
+            d1 = T(-12715105075.0) / 11282082432.0, d3 = T(87487479700.0) / 32700410799.0, d4 = T(-10690763975.0) / 1880347072.0,
+            d5 = T(701980252875.0) / 199316789632.0, d6 = T(-1453857185.0) / 822651844.0, d7 = T(69997945.0) / 29380423.0;
+
+        const T h = s.h;
+        const T* y = s.y;
+        const T* k1 = s.k1;
+        T k2[4], k3[4], k4[4], k5[4], k6[4], k7[4], t[4], yn[4];
+
+        for (int j = 0; j < 4; j++) t[j] = y[j] + h * a21 * k1[j];
+        derivative(t, k2);
+        for (int j = 0; j < 4; j++) t[j] = y[j] + h * (a31 * k1[j] + a32 * k2[j]);
+        derivative(t, k3);
+        for (int j = 0; j < 4; j++) t[j] = y[j] + h * (a41 * k1[j] + a42 * k2[j] + a43 * k3[j]);
+        derivative(t, k4);
+        for (int j = 0; j < 4; j++) t[j] = y[j] + h * (a51 * k1[j] + a52 * k2[j] + a53 * k3[j] + a54 * k4[j]);
+        derivative(t, k5);
+        for (int j = 0; j < 4; j++) t[j] = y[j] + h * (a61 * k1[j] + a62 * k2[j] + a63 * k3[j] + a64 * k4[j] + a65 * k5[j]);
+        derivative(t, k6);
+        for (int j = 0; j < 4; j++) yn[j] = y[j] + h * (a71 * k1[j] + a73 * k3[j] + a74 * k4[j] + a75 * k5[j] + a76 * k6[j]);
+        derivative(yn, k7);
+
+        // RMS of the embedded error estimate, scaled by the mixed tolerance;
+        // step control only needs double whatever T is
+        double err = 0.0;
+        for (int j = 0; j < 4; j++)
+        {
+            double e = (double)(h * (e1 * k1[j] + e3 * k3[j] + e4 * k4[j] + e5 * k5[j] + e6 * k6[j] + e7 * k7[j]));
+            double sc = atol + rtol * fmax(fabs((double)y[j]), fabs((double)yn[j]));
+            err += (e / sc) * (e / sc);
+        }
+        err = sqrt(err * 0.25);
+
+        // standard controller: safety 0.9, growth limited to [0.2, 10]
+        double fac = err > 0.0 ? 0.9 * simd::scalarPow(err, -0.2) : 10.0;
+        fac = fmin(10.0, fmax(0.2, fac));
+
+        if (!(err <= 1.0) && !force)
+        {
+            s.h = h * T(err == err ? fac : 0.2);
+            return false;
+        }
+
+        for (int j = 0; j < 4; j++)
+        {
+            T ydiff = yn[j] - y[j];
+            T bspl = h * k1[j] - ydiff;
+            s.rcont[0][j] = y[j];
+            s.rcont[1][j] = ydiff;
+            s.rcont[2][j] = bspl;
+            s.rcont[3][j] = ydiff - h * k7[j] - bspl;
+            s.rcont[4][j] = h * (d1 * k1[j] + d3 * k3[j] + d4 * k4[j] + d5 * k5[j] + d6 * k6[j] + d7 * k7[j]);
+            s.y[j] = yn[j];
+            s.k1[j] = k7[j];
+        }
+        s.hLast = h;
+        s.lead += h;
+        s.h = h * T(fac);
+        return true;
+    }
+
+    // state at `theta` in [0, 1] across the last accepted step
+    static void dense(const AdaptiveState<T>& s, T theta, T* out)
+    {
+        T theta1 = 1 - theta;
+        for (int j = 0; j < 4; j++)
+            out[j] = s.rcont[0][j] + theta * (s.rcont[1][j] + theta1 * (s.rcont[2][j]
+                + theta * (s.rcont[3][j] + theta1 * s.rcont[4][j])));
+    }
+
+    // step until the trajectory reaches `span` past the current frame time
+    // (span has the sign of the integration direction), write the interpolated
+    // frame state to out and rebase lead on the new frame time
+    void advance(AdaptiveState<T>& s, T span, T* out) const
+    {
+        using std::fabs;
+        const T dir = span < 0 ? T(-1) : T(1);
+        const T hMin = fabs(span) * T(MIN_STEP_FRACTION);
+
+        while (dir * s.lead < dir * span)
+        {
+            bool force = fabs(s.h) <= hMin;
+            if (force) s.h = dir * hMin;
+            tryStep(s, force);
+        }
+
+        if (s.hLast == T(0))
+        {
+            for (int j = 0; j < 4; j++) out[j] = s.y[j];
+        }
+        else
+        {
+            // position of the frame time inside the last step
+            T theta = 1 - (s.lead - span) / s.hLast;
+            if (theta < T(0)) theta = T(0);
+            if (theta > T(1)) theta = T(1);
+            dense(s, theta, out);
+        }
+        s.lead -= span;
+    }
+};
@@ -0,0 +1,172 @@
+﻿#pragma once
+#include <cmath>
+#include <limits>
+
+// -------- double-double arithmetic --------
+// A value is the unevaluated sum hi + lo of two doubles with |lo| <= ulp(hi)/2,
+// giving about 106 bits (32 decimal digits) of precision. Only what the
+// pendulum integrators need is provided: + - * /, comparisons, fabs, sqrt,
+// sin and cos. Error-free products rely on std::fma.
+struct DoubleDouble
+{
+    double hi = 0.0;
+    double lo = 0.0;
+
+    DoubleDouble() = default;
+    DoubleDouble(double x) : hi(x), lo(0.0) {}
+    DoubleDouble(double h, double l) : hi(h), lo(l) {}
+
+    explicit operator double() const { return hi + lo; }
+    explicit operator float() const { return (float)(hi + lo); }
+    explicit operator long double() const { return (long double)hi + (long double)lo; }
+
+    // ---- error-free transformations ----
+    static DoubleDouble twoSum(double a, double b)
+    {
+        double s = a + b;
+        double bb = s - a;
+        return DoubleDouble(s, (a - (s - bb)) + (b - bb));
+    }
+
+    static DoubleDouble quickTwoSum(double a, double b)
+    {
+        double s = a + b;
+        return DoubleDouble(s, b - (s - a));
+    }
+
+    static DoubleDouble twoProd(double a, double b)
+    {
+        double p = a * b;
+        return DoubleDouble(p, std::fma(a, b, -p));
+    }
+
+    friend DoubleDouble operator+(const DoubleDouble& a, const DoubleDouble& b)
+    {
+        DoubleDouble s = twoSum(a.hi, b.hi);
+        DoubleDouble t = twoSum(a.lo, b.lo);
+        s.lo += t.hi;
+        s = quickTwoSum(s.hi, s.lo);
+        s.lo += t.lo;
+        return quickTwoSum(s.hi, s.lo);
+    }
+
+    friend DoubleDouble operator-(const DoubleDouble& a)
+    {
+        return DoubleDouble(-a.hi, -a.lo);
+    }
+
+    friend DoubleDouble operator-(const DoubleDouble& a, const DoubleDouble& b)
+    {
+        return a + (-b);
+    }
+
+    friend DoubleDouble operator*(const DoubleDouble& a, const DoubleDouble& b)
+    {
+        DoubleDouble p = twoProd(a.hi, b.hi);
+        p.lo += a.hi * b.lo + a.lo * b.hi;
+        return quickTwoSum(p.hi, p.lo);
+    }
+
+    friend DoubleDouble operator/(const DoubleDouble& a, const DoubleDouble& b)
+    {
+        // long division: three quotient digits
+        double q1 = a.hi / b.hi;
+        DoubleDouble r = a - b * DoubleDouble(q1);
+        double q2 = r.hi / b.hi;
+        r = r - b * DoubleDouble(q2);
+        double q3 = r.hi / b.hi;
+        DoubleDouble q = quickTwoSum(q1, q2);
+        return q + DoubleDouble(q3);
+    }
+
+    // mixed operands, so float/double/int literals in the kernels work unchanged
+    friend DoubleDouble operator+(const DoubleDouble& a, double b) { return a + DoubleDouble(b); }
+    friend DoubleDouble operator+(double a, const DoubleDouble& b) { return DoubleDouble(a) + b; }
+    friend DoubleDouble operator-(const DoubleDouble& a, double b) { return a - DoubleDouble(b); }
+    friend DoubleDouble operator-(double a, const DoubleDouble& b) { return DoubleDouble(a) - b; }
+    friend DoubleDouble operator*(const DoubleDouble& a, double b) { return a * DoubleDouble(b); }
+    friend DoubleDouble operator*(double a, const DoubleDouble& b) { return DoubleDouble(a) * b; }
+    friend DoubleDouble operator/(const DoubleDouble& a, double b) { return a / DoubleDouble(b); }
+    friend DoubleDouble operator/(double a, const DoubleDouble& b) { return DoubleDouble(a) / b; }
+
+    DoubleDouble& operator+=(const DoubleDouble& b) { return *this = *this + b; }
+    DoubleDouble& operator-=(const DoubleDouble& b) { return *this = *this - b; }
+    DoubleDouble& operator*=(const DoubleDouble& b) { return *this = *this * b; }
+    DoubleDouble& operator/=(const DoubleDouble& b) { return *this = *this / b; }
+
+    friend bool operator<(const DoubleDouble& a, const DoubleDouble& b) { return a.hi < b.hi || (a.hi == b.hi && a.lo < b.lo); }
+    friend bool operator>(const DoubleDouble& a, const DoubleDouble& b) { return b < a; }
+    friend bool operator<=(const DoubleDouble& a, const DoubleDouble& b) { return !(b < a); }
+    friend bool operator>=(const DoubleDouble& a, const DoubleDouble& b) { return !(a < b); }
+    friend bool operator==(const DoubleDouble& a, const DoubleDouble& b) { return a.hi == b.hi && a.lo == b.lo; }
+    friend bool operator!=(const DoubleDouble& a, const DoubleDouble& b) { return !(a == b); }
+
+    // ---- functions, found by argument-dependent lookup ----
+    friend DoubleDouble fabs(const DoubleDouble& a) { return a.hi < 0.0 ? -a : a; }
+
+    friend DoubleDouble sqrt(const DoubleDouble& a)
+    {
+        if (a.hi <= 0.0) return DoubleDouble(std::sqrt(a.hi));
+        // one Newton step from the double root doubles the precision
+        double x = std::sqrt(a.hi);
+        DoubleDouble r = a - twoProd(x, x);
+        return quickTwoSum(x, r.hi / (2.0 * x));
+    }
+
+    // sin and cos of r in [-pi/4, pi/4] by their Taylor series
+    static void sincosReduced(const DoubleDouble& r, DoubleDouble& s, DoubleDouble& c)
+    {
+        const double eps = 1e-33;
+        DoubleDouble r2 = r * r;
+
+        DoubleDouble term = r;
+        s = r;
+        for (int n = 3; std::fabs(term.hi) > eps; n += 2)
+        {
+            term = -(term * r2) / DoubleDouble((double)((n - 1) * n));
+            s += term;
+        }
+
+        term = DoubleDouble(1.0);
+        c = DoubleDouble(1.0);
+        for (int n = 2; std::fabs(term.hi) > eps; n += 2)
+        {
+            term = -(term * r2) / DoubleDouble((double)((n - 1) * n));
+            c += term;
+        }
+    }
+
+    // reduce by multiples of pi/2 and fix up the quadrant
+    static void sincos(const DoubleDouble& x, DoubleDouble& s, DoubleDouble& c)
+    {
+        const DoubleDouble PI_2(1.570796326794896558e+00, 6.123233995736766036e-17);
+        double j = std::nearbyint(x.hi / PI_2.hi);
+        DoubleDouble r = x - PI_2 * DoubleDouble(j);
+        DoubleDouble sr, cr;
+        sincosReduced(r, sr, cr);
+
+        long long q = (long long)j & 3;
+        switch (q)
+        {
+        case 0: s = sr; c = cr; break;
+        case 1: s = cr; c = -sr; break;
+        case 2: s = -sr; c = -cr; break;
+        default: s = -cr; c = sr; break;
+        }
+    }
+
+    friend DoubleDouble sin(const DoubleDouble& x) { DoubleDouble s, c; sincos(x, s, c); return s; }
+    friend DoubleDouble cos(const DoubleDouble& x) { DoubleDouble s, c; sincos(x, s, c); return c; }
+};
+
+namespace std
+{
+    template <>
+    class numeric_limits<DoubleDouble> : public numeric_limits<double>
+    {
+    public:
+        static DoubleDouble epsilon() { return DoubleDouble(4.93038065763132e-32); } // 2^-104
+        static constexpr int digits = 106;
+        static constexpr int digits10 = 31;
+    };
+}
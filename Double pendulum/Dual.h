@@ -0,0 +1,146 @@
+﻿#pragma once
+#include <math.h>
+#include <cmath>
+#include <type_traits>
+#include "SimdMath.h"
+
+// -------- forward-mode dual numbers --------
+// Dual<T, N> carries a value and its derivatives along N directions. Running
+// any of the templated formulas (accelerations(), stepRK4(), ...) on duals
+// gives their directional derivatives exactly, without a hand-derived Jacobian.
+// T may be a scalar type or a SIMD vector (simd::vfloat), which then
+// differentiates V::width members at once. Only what those formulas use is
+// provided: + - * /, mixing with plain constants, and sin/cos through
+// simd::sinCos(), sincos(), scalarSin() and scalarCos(). The value parts are
+// computed as the formula computes T, so a state stepped on duals follows the
+// same trajectory as one stepped on T (bit for bit unless the compiler fuses
+// multiply-adds differently, never in a SIMD_DETERMINISTIC build).
+template <typename T, int N>
+struct Dual
+{
+    // a plain number or a T: a constant, whose derivatives are zero
+    template <typename S>
+    using IfConstant = typename std::enable_if<std::is_arithmetic<S>::value || std::is_same<S, T>::value>::type;
+
+    T v;        // value
+    T d[N];     // derivative along each direction
+
+    Dual() = default;
+    Dual(T value) : v(value) { for (int j = 0; j < N; j++) d[j] = T(0); }
+
+    // constants convert like T does (int -> float, float -> simd::vfloat, ...)
+    template <typename S, typename = IfConstant<S>>
+    Dual(S value) : Dual(T(value)) {}
+
+    friend Dual operator+(const Dual& a, const Dual& b)
+    {
+        Dual r;
+        r.v = a.v + b.v;
+        for (int j = 0; j < N; j++) r.d[j] = a.d[j] + b.d[j];
+        return r;
+    }
+
+    friend Dual operator-(const Dual& a, const Dual& b)
+    {
+        Dual r;
+        r.v = a.v - b.v;
+        for (int j = 0; j < N; j++) r.d[j] = a.d[j] - b.d[j];
+        return r;
+    }
+
+    friend Dual operator-(const Dual& a)
+    {
+        Dual r;
+        r.v = -a.v;
+        for (int j = 0; j < N; j++) r.d[j] = -a.d[j];
+        return r;
+    }
+
+    friend Dual operator*(const Dual& a, const Dual& b)
+    {
+        Dual r;
+        r.v = a.v * b.v;
+        for (int j = 0; j < N; j++) r.d[j] = a.d[j] * b.v + a.v * b.d[j];
+        return r;
+    }
+
+    friend Dual operator/(const Dual& a, const Dual& b)
+    {
+        Dual r;
+        T inv = T(1) / b.v;
+        r.v = a.v / b.v;
+        for (int j = 0; j < N; j++) r.d[j] = (a.d[j] - r.v * b.d[j]) * inv;
+        return r;
+    }
+
+    // a constant on either side skips the derivative products
+    template <typename S, typename = IfConstant<S>>
+    friend Dual operator*(S s, const Dual& a) { return scale(T(s), a); }
+    template <typename S, typename = IfConstant<S>>
+    friend Dual operator*(const Dual& a, S s) { return scale(T(s), a); }
+    template <typename S, typename = IfConstant<S>>
+    friend Dual operator/(const Dual& a, S s)
+    {
+        Dual r;
+        r.v = a.v / T(s);
+        for (int j = 0; j < N; j++) r.d[j] = a.d[j] / T(s);
+        return r;
+    }
+
+    Dual& operator+=(const Dual& b) { return *this = *this + b; }
+    Dual& operator-=(const Dual& b) { return *this = *this - b; }
+
+    static Dual scale(T s, const Dual& a)
+    {
+        Dual r;
+        r.v = s * a.v;
+        for (int j = 0; j < N; j++) r.d[j] = s * a.d[j];
+        return r;
+    }
+};
+
+namespace simd
+{
+    // sin and cos of a dual: (sin v, cos v * d) and (cos v, -sin v * d)
+    template <typename T, int N>
+    inline void sinCos(const Dual<T, N>& x, Dual<T, N>& s, Dual<T, N>& c)
+    {
+        T sv, cv;
+        sinCos(x.v, sv, cv);
+        s.v = sv;
+        c.v = cv;
+        for (int j = 0; j < N; j++)
+        {
+            s.d[j] = cv * x.d[j];
+            c.d[j] = -(sv * x.d[j]);
+        }
+    }
+
+    // the SIMD kernels' spelling (accelBatch)
+    template <typename T, int N>
+    inline void sincos(const Dual<T, N>& x, Dual<T, N>& s, Dual<T, N>& c) { sinCos(x, s, c); }
+
+    template <typename T, int N>
+    inline Dual<T, N> scalarSin(const Dual<T, N>& x)
+    {
+        Dual<T, N> s, c;
+        sinCos(x, s, c);
+        return s;
+    }
+
+    template <typename T, int N>
+    inline Dual<T, N> scalarCos(const Dual<T, N>& x)
+    {
+        Dual<T, N> s, c;
+        sinCos(x, s, c);
+        return c;
+    }
+}
+
+// the value of a plain number or of a dual, for comparisons such as the
+// convergence tests of the implicit integrators
+template <typename T>
+inline const T& primal(const T& x) { return x; }
+
+template <typename T, int N>
+inline const T& primal(const Dual<T, N>& x) { return x.v; }
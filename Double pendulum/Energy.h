@@ -0,0 +1,83 @@
+﻿#pragma once
+#include <math.h>
+#include <cmath>
+#include "SimParams.h"
+#include "SimdMath.h"
+
+// -------- total energy of the double pendulum --------
+// The Hamiltonian of Integrators.h written in angular velocities, with the
+// same l1, l2, m1, m2, g the integrators use:
+//   E = 1/2 (m1+m2) l1^2 w1^2 + 1/2 m2 l2^2 w2^2 + m2 l1 l2 w1 w2 cos(th1 - th2)
+//       - (m1+m2) g l1 cos(th1) - m2 g l2 cos(th2)
+// Drift is measured relative to max(|E0|, scale), where scale is the size of
+// the potential term, so members starting near E = 0 do not divide by ~0.
+template <typename T>
+struct EnergyConsts
+{
+    T halfM12L1Sq;  // 1/2 (m1+m2) l1^2
+    T halfM2L2Sq;   // 1/2 m2 l2^2
+    T m2L1L2;       // m2 l1 l2
+    T gM12L1;       // g (m1+m2) l1
+    T gM2L2;        // g m2 l2
+    T scale;        // |g| ((m1+m2) l1 + m2 l2)
+
+    explicit EnergyConsts(const SimParams& p)
+    {
+        T l1 = T(p.l1), l2 = T(p.l2), m1 = T(p.m1), m2 = T(p.m2), g = T(p.gravity);
+        halfM12L1Sq = T(0.5) * (m1 + m2) * l1 * l1;
+        halfM2L2Sq = T(0.5) * m2 * l2 * l2;
+        m2L1L2 = m2 * l1 * l2;
+        gM12L1 = g * (m1 + m2) * l1;
+        gM2L2 = g * m2 * l2;
+        T absG = g < T(0) ? -g : g;
+        scale = absG * ((m1 + m2) * l1 + m2 * l2);
+    }
+};
+
+template <typename T>
+inline T pendulumEnergy(T th1, T th2, T w1, T w2, const EnergyConsts<T>& k)
+{
+    return k.halfM12L1Sq * w1 * w1 + k.halfM2L2Sq * w2 * w2 + k.m2L1L2 * w1 * w2 * simd::scalarCos(T(th1 - th2))
+        - k.gM12L1 * simd::scalarCos(th1) - k.gM2L2 * simd::scalarCos(th2);
+}
+
+// energies of [0, count) members, V::width at a time (same padding rules as
+// stepRK4Batch). A whole check, statistics included, costs about half of one
+// float RK4 step, so checking every 25 steps or more stays under 2%.
+template <typename V>
+inline void energyBatch(const float* theta1, const float* theta2, const float* omega1, const float* omega2,
+    float* energy, int count, const EnergyConsts<float>& k)
+{
+    for (int i = 0; i < count; i += V::width)
+    {
+        V th1 = V::load(theta1 + i), th2 = V::load(theta2 + i);
+        V w1 = V::load(omega1 + i), w2 = V::load(omega2 + i);
+        V s1, c1, s2, c2, sd, cd;
+        simd::sincos(th1, s1, c1);
+        simd::sincos(th2, s2, c2);
+        simd::sincos(th1 - th2, sd, cd);
+        V e = V(k.halfM12L1Sq) * w1 * w1 + V(k.halfM2L2Sq) * w2 * w2 + V(k.m2L1L2) * w1 * w2 * cd
+            - V(k.gM12L1) * c1 - V(k.gM2L2) * c2;
+        e.store(energy + i);
+    }
+}
+
+// relative drift over the live members at the last check
+struct EnergyStats
+{
+    float minDrift = 0.0f;
+    float maxDrift = 0.0f;
+    float meanDrift = 0.0f;
+    float worstDrift = 0.0f;    // largest |drift| seen since the baseline was taken
+    int flagged = 0;            // members over the threshold so far
+    double time = 0.0;          // ensemble time of the last check
+
+    // field by field, the padding after `flagged` is not part of a checkpoint
+    template <typename A>
+    void serialize(A& ar)
+    {
+        ar.io(minDrift); ar.io(maxDrift); ar.io(meanDrift); ar.io(worstDrift);
+        ar.io(flagged);
+        ar.io(time);
+    }
+};
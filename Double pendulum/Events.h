@@ -0,0 +1,258 @@
+﻿#pragma once
+#include <math.h>
+#include <cmath>
+#include "AppendBuffer.h"
+#include "Pendulum.h"
+
+// -------- in-step event detection --------
+// After every step the integrator compares the old and new state of each
+// member. The rare members with a sign change get the event time located
+// inside the step on the cubic Hermite interpolant of that step: angles use
+// their rates at both ends (free), rates use the accelerations at both ends
+// (two extra evaluations, only for members that actually had an event).
+// Flip events are arm j crossing the upright position. With this repo's
+// sign convention (gravity < 0 pulls towards theta = pi) that is theta = 0
+// mod 2 pi; with gravity > 0 it is theta = pi mod 2 pi.
+enum class EventKind
+{
+    Flip1,
+    Flip2,
+    Omega1Zero,
+    Omega2Zero,
+    Count
+};
+
+inline const char* eventName(EventKind kind)
+{
+    switch (kind)
+    {
+    case EventKind::Flip1: return "Arm 1 flips";
+    case EventKind::Flip2: return "Arm 2 flips";
+    case EventKind::Omega1Zero: return "Omega 1 = 0";
+    case EventKind::Omega2Zero: return "Omega 2 = 0";
+    default: return "?";
+    }
+}
+
+inline int eventBit(EventKind kind) { return 1 << (int)kind; }
+
+struct PendulumEvent
+{
+    int member;     // id of the member, stable across compaction
+    EventKind kind;
+    double time;    // ensemble time of the event
+};
+
+// Poincare section: the hyperplane state[variable] = value of
+// { theta1, theta2, omega1, omega2 }, angles taken mod 2 pi, counted when
+// crossed in `direction` (+1 increasing, -1 decreasing, 0 both)
+struct PoincareSection
+{
+    int variable = -1;      // -1 = off
+    double value = 0.0;
+    int direction = 1;
+
+    bool enabled() const { return variable >= 0 && variable < 4; }
+};
+
+// state of a member where it crossed the section
+struct SectionPoint
+{
+    double time;        // ensemble time of the crossing
+    int member;         // id of the member
+    float state[4];     // theta1, theta2, omega1, omega2
+};
+
+struct EventDetector
+{
+    static constexpr double TWO_PI = 6.283185307179586;
+
+    int mask = 0;           // eventBit()s to look for
+    double top = 0.0;       // upright angle
+    PoincareSection section;
+    AppendBuffer<SectionPoint>* sectionOut = nullptr;  // where refine() puts crossings
+
+    EventDetector(int mask_, float gravity) : mask(mask_), top(gravity < 0.0f ? 0.0 : 3.141592653589793) {}
+
+    EventDetector(int mask_, float gravity, const PoincareSection& section_, AppendBuffer<SectionPoint>* sectionOut_)
+        : EventDetector(mask_, gravity)
+    {
+        if (section_.enabled() && sectionOut_)
+        {
+            section = section_;
+            sectionOut = sectionOut_;
+        }
+    }
+
+    // anything to look for at all
+    bool active() const { return mask || sectionOut; }
+
+    // index of the 2 pi cell starting at the upright angle
+    double cell(double theta) const { return floor((theta - top) / TWO_PI); }
+
+    // lanes of V that may hold an event between state a and state b: a cheap
+    // vector test, refine() makes the exact decision
+    template <typename V>
+    int candidates(V aTh1, V aTh2, V aW1, V aW2, V bTh1, V bTh2, V bW1, V bW2) const
+    {
+        int lanes = 0;
+        if (mask & eventBit(EventKind::Omega1Zero)) lanes |= V::signMask(aW1) ^ V::signMask(bW1);
+        if (mask & eventBit(EventKind::Omega2Zero)) lanes |= V::signMask(aW2) ^ V::signMask(bW2);
+        const V inv(float(1.0 / TWO_PI)), half(0.5f), quarter(0.25f);
+        // angle passing offset mod 2 pi
+        auto crossed = [&](V a, V b, V offset) {
+            V d = V::roundNearest((b - offset) * inv - half) - V::roundNearest((a - offset) * inv - half);
+            return V::signMask(quarter - d * d);
+        };
+        if (mask & eventBit(EventKind::Flip1)) lanes |= crossed(aTh1, bTh1, V((float)top));
+        if (mask & eventBit(EventKind::Flip2)) lanes |= crossed(aTh2, bTh2, V((float)top));
+        if (sectionOut)
+        {
+            const V value((float)section.value);
+            switch (section.variable)
+            {
+            case 0: lanes |= crossed(aTh1, bTh1, value); break;
+            case 1: lanes |= crossed(aTh2, bTh2, value); break;
+            case 2: lanes |= V::signMask(aW1 - value) ^ V::signMask(bW1 - value); break;
+            default: lanes |= V::signMask(aW2 - value) ^ V::signMask(bW2 - value); break;
+            }
+        }
+        return lanes;
+    }
+
+    // exact test of one member over a step of size h starting at ensemble time
+    // t0, y = { theta1, theta2, omega1, omega2 }; found events go to out and
+    // their eventBit()s are returned, a section crossing goes to sectionOut
+    template <typename T, typename K>
+    int refine(int member, double t0, double h, const T* y0, const T* y1, const K& k,
+        AppendBuffer<PendulumEvent>& out) const
+    {
+        int found = 0;
+        double a[4], b[4];
+        for (int j = 0; j < 4; j++) { a[j] = (double)y0[j]; b[j] = (double)y1[j]; }
+        double da[2], db[2];    // accelerations at both ends, computed on demand
+        bool haveAccel = false;
+        auto needAccel = [&]() {
+            if (haveAccel) return;
+            T a1, a2;
+            accelerations(y0[0], y0[1], y0[2], y0[3], k, a1, a2);
+            da[0] = (double)a1; da[1] = (double)a2;
+            accelerations(y1[0], y1[1], y1[2], y1[3], k, a1, a2);
+            db[0] = (double)a1; db[1] = (double)a2;
+            haveAccel = true;
+        };
+
+        for (int arm = 0; arm < 2; arm++)
+        {
+            EventKind flip = arm == 0 ? EventKind::Flip1 : EventKind::Flip2;
+            if (mask & eventBit(flip))
+            {
+                double tau = flipFraction(a[arm], b[arm], h * a[2 + arm], h * b[2 + arm]);
+                if (tau >= 0.0)
+                {
+                    out.push({ member, flip, t0 + tau * h });
+                    found |= eventBit(flip);
+                }
+            }
+
+            EventKind zero = arm == 0 ? EventKind::Omega1Zero : EventKind::Omega2Zero;
+            if ((mask & eventBit(zero)) && ((a[2 + arm] < 0.0) != (b[2 + arm] < 0.0)))
+            {
+                needAccel();
+                double tau = hermiteRoot(a[2 + arm], b[2 + arm], h * da[arm], h * db[arm]);
+                out.push({ member, zero, t0 + tau * h });
+                found |= eventBit(zero);
+            }
+        }
+
+        if (sectionOut)
+        {
+            const int v = section.variable;
+            double tau = -1.0;
+            int direction = 0;
+            if (v < 2)
+            {
+                double c0 = floor((a[v] - section.value) / TWO_PI), c1 = floor((b[v] - section.value) / TWO_PI);
+                if (c0 != c1)
+                {
+                    double boundary = section.value + TWO_PI * (c0 > c1 ? c0 : c1);
+                    direction = c1 > c0 ? 1 : -1;
+                    if (section.direction == 0 || section.direction == direction)
+                        tau = hermiteRoot(a[v] - boundary, b[v] - boundary, h * a[2 + v], h * b[2 + v]);
+                }
+            }
+            else if ((a[v] < section.value) != (b[v] < section.value))
+            {
+                direction = b[v] > a[v] ? 1 : -1;
+                if (section.direction == 0 || section.direction == direction)
+                {
+                    needAccel();
+                    tau = hermiteRoot(a[v] - section.value, b[v] - section.value, h * da[v - 2], h * db[v - 2]);
+                }
+            }
+            if (tau >= 0.0)
+            {
+                // the whole state on the step's Hermite interpolant
+                needAccel();
+                SectionPoint p;
+                p.time = t0 + tau * h;
+                p.member = member;
+                for (int j = 0; j < 2; j++)
+                {
+                    p.state[j] = (float)hermite(tau, a[j], b[j], h * a[2 + j], h * b[2 + j]);
+                    p.state[2 + j] = (float)hermite(tau, a[2 + j], b[2 + j], h * da[j], h * db[j]);
+                }
+                sectionOut->push(p);
+            }
+        }
+        return found;
+    }
+
+    // where in a step an arm going from angle a to b (scaled rates ma, mb)
+    // passes the upright position, as a fraction in [0, 1]; -1 if it does not
+    double flipFraction(double a, double b, double ma, double mb) const
+    {
+        double c0 = cell(a), c1 = cell(b);
+        if (c0 == c1) return -1.0;
+        double boundary = top + TWO_PI * (c0 > c1 ? c0 : c1);
+        return hermiteRoot(a - boundary, b - boundary, ma, mb);
+    }
+
+    // cubic Hermite interpolant at t in [0, 1] with values p0, p1 and scaled slopes m0, m1
+    static double hermite(double t, double p0, double p1, double m0, double m1)
+    {
+        double t2 = t * t, t3 = t2 * t;
+        return (2 * t3 - 3 * t2 + 1) * p0 + (t3 - 2 * t2 + t) * m0
+            + (3 * t2 - 2 * t3) * p1 + (t3 - t2) * m1;
+    }
+
+    // root in [0, 1] of the cubic Hermite interpolant with values p0, p1 and
+    // scaled slopes m0, m1 (p0 and p1 of opposite sign), by Illinois regula falsi
+    static double hermiteRoot(double p0, double p1, double m0, double m1)
+    {
+        auto p = [&](double t) { return hermite(t, p0, p1, m0, m1); };
+        double lo = 0.0, hi = 1.0, flo = p0, fhi = p1;
+        if (flo == 0.0) return 0.0;
+        if (fhi == 0.0) return 1.0;
+        int side = 0;
+        for (int it = 0; it < 60 && hi - lo > 1e-12; it++)
+        {
+            double t = (lo * fhi - hi * flo) / (fhi - flo);
+            double ft = p(t);
+            if (ft == 0.0) return t;
+            if ((ft < 0.0) == (flo < 0.0))
+            {
+                lo = t; flo = ft;
+                if (side == -1) fhi *= 0.5;
+                side = -1;
+            }
+            else
+            {
+                hi = t; fhi = ft;
+                if (side == 1) flo *= 0.5;
+                side = 1;
+            }
+        }
+        return (lo * fhi - hi * flo) / (fhi - flo);
+    }
+};
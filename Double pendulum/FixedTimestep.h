@@ -0,0 +1,49 @@
+﻿#pragma once
+
+// -------- fixed-timestep accumulator --------
+// Turns wall-clock frame times into a whole number of physics steps so the
+// simulation advances by the same physical time on every machine, whatever
+// the refresh rate. Leftover time is kept for the next frame and exposed as
+// alpha() to interpolate the rendered state between the last two steps.
+class FixedTimestep
+{
+public:
+    double step = 0.01;         // physics step, simulated seconds
+    double timeScale = 3.0;     // simulated seconds per real second
+    double maxFrameTime = 0.25; // real seconds; longer frames are dropped, not caught up
+
+    void reset(double now)
+    {
+        last = now;
+        accumulator = 0.0;
+    }
+
+    // number of physics steps to run for a frame ending at `now`
+    int advance(double now, bool paused)
+    {
+        if (last < 0.0) last = now;
+        double frame = now - last;
+        last = now;
+        if (paused || frame <= 0.0) return 0;
+        if (frame > maxFrameTime) frame = maxFrameTime;
+
+        accumulator += frame * timeScale;
+        int steps = (int)(accumulator / step);
+        accumulator -= steps * step;
+        return steps;
+    }
+
+    // fraction of a step elapsed since the last physics state, in [0, 1].
+    // advance() keeps the leftover below one step, but a smaller `step` set
+    // while paused can leave several pending; those are drawn at the last
+    // state rather than extrapolated past it.
+    float alpha() const
+    {
+        double a = accumulator / step;
+        return (float)(a < 1.0 ? a : 1.0);
+    }
+
+private:
+    double last = -1.0;
+    double accumulator = 0.0;
+};
@@ -0,0 +1,259 @@
+﻿#pragma once
+#include <math.h>
+#include <cmath>
+#include <cstdio>
+#include <vector>
+#include "PendulumKernels.h"
+#include "Presets.h"
+#include "Events.h"
+#include "Energy.h"
+#include "ThreadPool.h"
+
+// -------- flip-time fractal (--fractal) --------
+// Every pixel is a double pendulum released at rest from (theta1, theta2),
+// measured from the hanging position: theta1 runs along x, theta2 up along
+// y. Its value is the time until either arm first flips over the top,
+// located inside the step like the flip events of Events.h, or NO_FLIP if
+// that takes longer than maxTime.
+//
+// The image is cut into tiles spread over the pool. Inside a tile V::width
+// pixels step together with float RK4 (rk4StepBatch); a lane whose pixel
+// flips or runs out of time is refilled with the tile's next pixel at once,
+// so the vector stays full until the tile runs dry. Pixels whose energy is
+// below that of the lowest upright configuration can never flip and are not
+// simulated at all; that is most of the image for small angles.
+// Each pixel's result depends only on its own start, never on the lane, tile
+// or thread it ran in.
+namespace fractal
+{
+    const float NO_FLIP = -1.0f;
+
+    struct Settings
+    {
+        int width = 1024;
+        int height = 1024;
+        double theta1Min = -3.141592653589793, theta1Max = 3.141592653589793;
+        double theta2Min = -3.141592653589793, theta2Max = 3.141592653589793;
+        float dt = 0.01f;
+        float maxTime = 100.0f;
+        int tile = 64;          // tile edge in pixels
+
+        // start angles at the pixel centres, hanging being the angle at rest;
+        // row 0 is the top of the image
+        float theta1At(int x, double hanging) const
+        {
+            return float(hanging + theta1Min + (x + 0.5) * (theta1Max - theta1Min) / width);
+        }
+        float theta2At(int y, double hanging) const
+        {
+            return float(hanging + theta2Max - (y + 0.5) * (theta2Max - theta2Min) / height);
+        }
+    };
+
+    // E < limit rules out a flip: reaching upright with arm 1 needs at least
+    // the potential of arm 1 up and arm 2 down, and the same for arm 2.
+    // The margin covers the energy error of RK4.
+    struct FlipBound
+    {
+        EnergyConsts<double> k;
+        double limit;
+
+        FlipBound(const SimParams& p, double top) : k(p)
+        {
+            double up = cos(top);   // +1 or -1
+            double arm1Up = -k.gM12L1 * up - fabs(k.gM2L2);
+            double arm2Up = -fabs(k.gM12L1) - k.gM2L2 * up;
+            limit = (arm1Up < arm2Up ? arm1Up : arm2Up) - 1e-3 * k.scale;
+        }
+
+        bool canFlip(float th1, float th2) const { return pendulumEnergy<double>(th1, th2, 0.0, 0.0, k) >= limit; }
+    };
+
+    const int FLIPS = (1 << (int)EventKind::Flip1) | (1 << (int)EventKind::Flip2);
+
+    // flip times of the n listed pixels (indices y * width + x) into map
+    template <typename V, typename K>
+    void flipTimesBatch(const Settings& s, const K& k, const EventDetector& detector, const FlipBound& bound,
+        const int* pixels, int n, float* map)
+    {
+        const int W = V::width;
+        const double hanging = detector.top + EventDetector::TWO_PI / 2;
+        std::vector<int> pending;
+        for (int i = 0; i < n; i++)
+        {
+            int p = pixels[i];
+            if (bound.canFlip(s.theta1At(p % s.width, hanging), s.theta2At(p / s.width, hanging)))
+                pending.push_back(p);
+            else
+                map[p] = NO_FLIP;
+        }
+        if (pending.empty()) return;
+
+        // lane l holds pixel[l] (-1 once the tile ran dry), loaded at step start[l]
+        alignas(64) float th1[W], th2[W], w1[W], w2[W];
+        alignas(64) float old1[W], old2[W], oldW1[W], oldW2[W];
+        int pixel[W];
+        long long start[W];
+        const long long maxSteps = (long long)ceil(s.maxTime / s.dt);
+        size_t next = 0;
+        int active = 0;
+        long long step = 0;
+
+        auto fill = [&](int l) {
+            if (next < pending.size())
+            {
+                int p = pending[next++];
+                pixel[l] = p;
+                start[l] = step;
+                th1[l] = s.theta1At(p % s.width, hanging);
+                th2[l] = s.theta2At(p / s.width, hanging);
+                active++;
+            }
+            else
+            {
+                pixel[l] = -1;     // at rest, never flips
+                th1[l] = th2[l] = float(hanging);
+            }
+            w1[l] = w2[l] = 0.0f;
+        };
+        // first step at which a lane runs out of time
+        auto expiry = [&]() {
+            long long first = step + maxSteps;
+            for (int l = 0; l < W; l++)
+                if (pixel[l] >= 0 && start[l] + maxSteps < first) first = start[l] + maxSteps;
+            return first;
+        };
+
+        for (int l = 0; l < W; l++) fill(l);
+        long long expires = expiry();
+        const V h(s.dt), half(0.5f * s.dt), sixth(s.dt / 6.0f);
+        V a1 = V::load(th1), a2 = V::load(th2), b1 = V::load(w1), b2 = V::load(w2);
+
+        while (active > 0)
+        {
+            V o1 = a1, o2 = a2, p1 = b1, p2 = b2;
+            rk4StepBatch(a1, a2, b1, b2, h, half, sixth, k);
+            step++;
+            int lanes = detector.candidates(o1, o2, p1, p2, a1, a2, b1, b2);
+            if (!lanes && step < expires) continue;
+
+            a1.store(th1); a2.store(th2); b1.store(w1); b2.store(w2);
+            o1.store(old1); o2.store(old2); p1.store(oldW1); p2.store(oldW2);
+            for (int l = 0; l < W; l++)
+            {
+                if (pixel[l] < 0) continue;
+                double tau = -1.0;
+                if (lanes & (1 << l))
+                {
+                    double f1 = detector.flipFraction(old1[l], th1[l], (double)s.dt * oldW1[l], (double)s.dt * w1[l]);
+                    double f2 = detector.flipFraction(old2[l], th2[l], (double)s.dt * oldW2[l], (double)s.dt * w2[l]);
+                    tau = f1 < 0.0 || (f2 >= 0.0 && f2 < f1) ? f2 : f1;
+                }
+                if (tau >= 0.0)
+                    map[pixel[l]] = float(((double)(step - 1 - start[l]) + tau) * s.dt);
+                else if (step - start[l] >= maxSteps)
+                    map[pixel[l]] = NO_FLIP;
+                else
+                    continue;
+                active--;
+                fill(l);
+            }
+            expires = expiry();
+            a1 = V::load(th1); a2 = V::load(th2); b1 = V::load(w1); b2 = V::load(w2);
+        }
+    }
+
+    // flipTimesBatch() for callers that do not hoist the constants
+    inline void flipTimes(const SimParams& params, const Settings& s, const int* pixels, int n, float* map)
+    {
+        const EventDetector detector(FLIPS, params.gravity);
+        const FlipBound bound(params, detector.top);
+        Presets::withConsts<float>(params, [&](const auto& k) {
+            flipTimesBatch<simd::vfloat>(s, k, detector, bound, pixels, n, map);
+            });
+    }
+
+    // flip time of every pixel, row-major from the top left. Tiles are
+    // handed to the pool one row of tiles at a time; progress(done, total)
+    // is called after each row.
+    template <typename F>
+    std::vector<float> render(const SimParams& params, const Settings& s, ThreadPool& pool, F&& progress)
+    {
+        std::vector<float> map((size_t)s.width * s.height, NO_FLIP);
+        const EventDetector detector(FLIPS, params.gravity);
+        const FlipBound bound(params, detector.top);
+        const int tilesX = (s.width + s.tile - 1) / s.tile;
+        const int tilesY = (s.height + s.tile - 1) / s.tile;
+
+        Presets::withConsts<float>(params, [&](const auto& k) {
+            for (int ty = 0; ty < tilesY; ty++)
+            {
+                pool.parallelFor(tilesX, 1, [&](int begin, int end) {
+                    std::vector<int> pixels;
+                    for (int tx = begin; tx < end; tx++)
+                    {
+                        int x0 = tx * s.tile, y0 = ty * s.tile;
+                        int x1 = x0 + s.tile < s.width ? x0 + s.tile : s.width;
+                        int y1 = y0 + s.tile < s.height ? y0 + s.tile : s.height;
+                        pixels.clear();
+                        for (int y = y0; y < y1; y++)
+                            for (int x = x0; x < x1; x++)
+                                pixels.push_back(y * s.width + x);
+                        flipTimesBatch<simd::vfloat>(s, k, detector, bound, pixels.data(), (int)pixels.size(), map.data());
+                    }
+                    });
+                progress(ty + 1, tilesY);
+            }
+            });
+        return map;
+    }
+
+    // brightness in [0, 1] of a flip time: early flips bright, fading
+    // logarithmically towards black at maxTime; NO_FLIP is black
+    inline double shade(float t, float maxTime)
+    {
+        if (t < 0.0f) return 0.0;
+        double v = 1.0 - log1p((double)t) / log1p((double)maxTime);
+        return v < 0.0 ? 0.0 : v;
+    }
+
+    // refinement bucket for QuadtreeMap: NO_FLIP, then `buckets` equal steps of shade()
+    inline int bucket(float t, float maxTime, int buckets = 32)
+    {
+        if (t < 0.0f) return -1;
+        int b = (int)(shade(t, maxTime) * buckets);
+        return b < buckets ? b : buckets - 1;
+    }
+
+    // 16-bit binary PGM of shade(), 1 and up for pixels that flip
+    inline bool writePGM(const char* path, const std::vector<float>& map, const Settings& s)
+    {
+        FILE* file = fopen(path, "wb");
+        if (!file) return false;
+        fprintf(file, "P5\n%d %d\n65535\n", s.width, s.height);
+        std::vector<unsigned char> row(2 * (size_t)s.width);
+        bool good = true;
+        for (int y = 0; y < s.height && good; y++)
+        {
+            for (int x = 0; x < s.width; x++)
+            {
+                float t = map[(size_t)y * s.width + x];
+                unsigned v = t < 0.0f ? 0 : 1 + (unsigned)(65534.0 * shade(t, s.maxTime) + 0.5);
+                row[2 * x] = (unsigned char)(v >> 8);      // PGM samples are big-endian
+                row[2 * x + 1] = (unsigned char)(v & 0xff);
+            }
+            good = fwrite(row.data(), 1, row.size(), file) == row.size();
+        }
+        return fclose(file) == 0 && good;
+    }
+
+    // the map as width * height raw floats in native byte order, row-major
+    // from the top left, NO_FLIP (-1) where nothing flipped
+    inline bool writeRaw(const char* path, const std::vector<float>& map)
+    {
+        FILE* file = fopen(path, "wb");
+        if (!file) return false;
+        bool good = fwrite(map.data(), sizeof(float), map.size(), file) == map.size();
+        return fclose(file) == 0 && good;
+    }
+}
@@ -0,0 +1,339 @@
+﻿#pragma once
+#include <math.h>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include "Dual.h"
+#include "Pendulum.h"
+#include "Presets.h"
+#include "ThreadPool.h"
+
+// -------- finite-time Lyapunov exponent fields (--ftle) --------
+// FTLE over a 2D slice of initial conditions: each pixel is one start whose
+// x and y set two of theta1, theta2, omega1, omega2, m2/m1 and l2/l1, the
+// other four coming from Settings::base and the parameters. Its value is
+//   FTLE = ln(largest singular value of the flow map Jacobian) / T
+// over the time T. The Jacobian comes from the variational equations: the
+// state steps with RK4 on Dual<simd::vfloat, 4> seeded with the identity,
+// V::width pixels at once, the same way as the Lyapunov mode of the ensemble.
+// It is renormalised every RENORMALIZE steps so float does not overflow on
+// chaotic starts. Unless an axis is a parameter the pixels share one set of
+// hoisted constants; otherwise every lane gets its pixel's constants
+// (BasicPendulumConsts<V>), so the batches stay full either way.
+//
+// The map is computed one row of tiles at a time and handed to the caller
+// row by row, so even huge maps only ever hold one band in memory.
+namespace ftle
+{
+    const int RENORMALIZE = 32;
+
+    enum class Axis
+    {
+        Theta1,         // from the hanging position, like fractal::Settings
+        Theta2,
+        Omega1,
+        Omega2,
+        MassRatio,      // m2 / m1, m1 as in the parameters
+        LengthRatio,    // l2 / l1, l1 as in the parameters
+        Count
+    };
+
+    inline const char* axisName(Axis a)
+    {
+        switch (a)
+        {
+        case Axis::Theta1: return "theta1";
+        case Axis::Theta2: return "theta2";
+        case Axis::Omega1: return "omega1";
+        case Axis::Omega2: return "omega2";
+        case Axis::MassRatio: return "m2/m1";
+        case Axis::LengthRatio: return "l2/l1";
+        default: return "?";
+        }
+    }
+
+    inline bool isParameter(Axis a) { return a == Axis::MassRatio || a == Axis::LengthRatio; }
+
+    inline void defaultRange(Axis a, double& lo, double& hi)
+    {
+        switch (a)
+        {
+        case Axis::Theta1: case Axis::Theta2: lo = -3.141592653589793; hi = 3.141592653589793; break;
+        case Axis::Omega1: case Axis::Omega2: lo = -5.0; hi = 5.0; break;
+        default: lo = 0.1; hi = 2.0; break;
+        }
+    }
+
+    struct Settings
+    {
+        int width = 512;
+        int height = 512;
+        Axis xAxis = Axis::Theta1;
+        Axis yAxis = Axis::Theta2;
+        double xMin = -3.141592653589793, xMax = 3.141592653589793;
+        double yMin = -3.141592653589793, yMax = 3.141592653589793;
+        double base[4] = { 0.0, 0.0, 0.0, 0.0 };   // theta1, theta2 (from hanging), omega1, omega2
+        float dt = 0.01f;
+        float time = 10.0f;
+        int tile = 64;
+
+        // pixel centres; row 0 is the top of the image
+        double xAt(int x) const { return xMin + (x + 0.5) * (xMax - xMin) / width; }
+        double yAt(int y) const { return yMax - (y + 0.5) * (yMax - yMin) / height; }
+        int steps() const { return (int)ceil(time / (dt < 0.0f ? -dt : dt)); }
+
+        // start state of pixel (x, y), `hanging` being the angle at rest
+        void stateAt(int x, int y, double hanging, float* state) const
+        {
+            double v[4] = { base[0], base[1], base[2], base[3] };
+            if (!isParameter(xAxis)) v[(int)xAxis] = xAt(x);
+            if (!isParameter(yAxis)) v[(int)yAxis] = yAt(y);
+            state[0] = float(hanging + v[0]);
+            state[1] = float(hanging + v[1]);
+            state[2] = float(v[2]);
+            state[3] = float(v[3]);
+        }
+
+        SimParams paramsAt(SimParams p, int x, int y) const
+        {
+            const Axis axes[2] = { xAxis, yAxis };
+            const double values[2] = { xAt(x), yAt(y) };
+            for (int i = 0; i < 2; i++)
+            {
+                if (axes[i] == Axis::MassRatio) p.m2 = float(values[i] * p.m1);
+                if (axes[i] == Axis::LengthRatio) p.l2 = float(values[i] * p.l1);
+            }
+            return p;
+        }
+    };
+
+    // largest eigenvalue of the symmetric 4x4 matrix a (overwritten), cyclic Jacobi
+    inline double largestEigenvalue(double (*a)[4])
+    {
+        for (int sweep = 0; sweep < 50; sweep++)
+        {
+            double off = 0.0, diag = 0.0;
+            for (int p = 0; p < 4; p++)
+            {
+                diag += a[p][p] * a[p][p];
+                for (int q = p + 1; q < 4; q++) off += a[p][q] * a[p][q];
+            }
+            if (off <= 1e-30 * diag) break;
+            for (int p = 0; p < 4; p++)
+                for (int q = p + 1; q < 4; q++)
+                {
+                    if (a[p][q] == 0.0) continue;
+                    double theta = (a[q][q] - a[p][p]) / (2.0 * a[p][q]);
+                    double t = (theta < 0.0 ? -1.0 : 1.0) / (fabs(theta) + sqrt(theta * theta + 1.0));
+                    double c = 1.0 / sqrt(t * t + 1.0), s = t * c;
+                    for (int k = 0; k < 4; k++)
+                    {
+                        double akp = a[k][p], akq = a[k][q];
+                        a[k][p] = c * akp - s * akq;
+                        a[k][q] = s * akp + c * akq;
+                    }
+                    for (int k = 0; k < 4; k++)
+                    {
+                        double apk = a[p][k], aqk = a[q][k];
+                        a[p][k] = c * apk - s * aqk;
+                        a[q][k] = s * apk + c * aqk;
+                    }
+                }
+        }
+        double largest = a[0][0];
+        for (int p = 1; p < 4; p++) if (a[p][p] > largest) largest = a[p][p];
+        return largest;
+    }
+
+    // FTLE of n starts (state[c][i] is component c of start i) over `steps`
+    // steps of dt, into out[0, n); constsAt(i) gives the constants of starts
+    // [i, i + V::width), shared or one set per lane
+    template <typename V, typename KAt>
+    void ftleBatch(KAt&& constsAt, const float* const* state, int n, float dt, int steps, float* out)
+    {
+        typedef Dual<V, 4> D;
+        const int W = V::width;
+        const double time = fabs((double)dt) * steps;
+        alignas(64) float lanes[4][W];
+        alignas(64) float phi[16][W];     // phi[4 * c + j][l] = d state c / d start j
+
+        for (int i = 0; i < n; i += W)
+        {
+            const int m = n - i < W ? n - i : W;
+            for (int c = 0; c < 4; c++)
+                for (int l = 0; l < W; l++) lanes[c][l] = l < m ? state[c][i + l] : 0.0f;
+            const auto& k = constsAt(i);
+            D x[4];
+            for (int c = 0; c < 4; c++)
+            {
+                x[c].v = V::load(lanes[c]);
+                for (int j = 0; j < 4; j++) x[c].d[j] = V(c == j ? 1.0f : 0.0f);
+            }
+
+            // the renormalisation is exact in float (a power of two), so it
+            // only moves the exponent range
+            double logScale[W];
+            for (int l = 0; l < W; l++) logScale[l] = 0.0;
+            for (int s = 0; s < steps; s++)
+            {
+                stepRK4<D>(x[0], x[1], x[2], x[3], D(V(dt)), k);
+                if ((s + 1) % RENORMALIZE && s + 1 < steps) continue;
+                for (int c = 0; c < 4; c++)
+                    for (int j = 0; j < 4; j++) x[c].d[j].store(phi[4 * c + j]);
+                for (int l = 0; l < W; l++)
+                {
+                    float largest = 0.0f;
+                    for (int e = 0; e < 16; e++) largest = fmaxf(largest, fabsf(phi[e][l]));
+                    if (!(largest > 0.0f) || !std::isfinite(largest)) continue;
+                    int exponent;
+                    frexpf(largest, &exponent);
+                    for (int e = 0; e < 16; e++) phi[e][l] = ldexpf(phi[e][l], -exponent);
+                    logScale[l] += exponent * 0.6931471805599453;
+                }
+                for (int c = 0; c < 4; c++)
+                    for (int j = 0; j < 4; j++) x[c].d[j] = V::load(phi[4 * c + j]);
+            }
+
+            for (int l = 0; l < m; l++)
+            {
+                // Cauchy-Green tensor phi^T phi, its largest eigenvalue is the
+                // square of the largest singular value
+                double cg[4][4];
+                for (int a = 0; a < 4; a++)
+                    for (int b = 0; b < 4; b++)
+                    {
+                        double sum = 0.0;
+                        for (int c = 0; c < 4; c++) sum += (double)phi[4 * c + a][l] * phi[4 * c + b][l];
+                        cg[a][b] = sum;
+                    }
+                out[i + l] = steps ? float((logScale[l] + 0.5 * log(largestEigenvalue(cg))) / time) : 0.0f;
+            }
+        }
+    }
+
+    // FTLE of the pixels [x0, x1) x [y0, y1) into band (rows from y0,
+    // `width` floats each)
+    inline void renderTile(const SimParams& params, const Settings& s, int x0, int y0, int x1, int y1, float* band)
+    {
+        const double hanging = params.gravity < 0.0f ? 3.141592653589793 : 0.0;
+        const int W = simd::vfloat::width;
+        std::vector<float> columns[4];
+        for (int y = y0; y < y1; y++)
+            for (int x = x0; x < x1; x++)
+            {
+                float start[4];
+                s.stateAt(x, y, hanging, start);
+                for (int c = 0; c < 4; c++) columns[c].push_back(start[c]);
+            }
+        const int n = (int)columns[0].size();
+        const float* state[4] = { columns[0].data(), columns[1].data(), columns[2].data(), columns[3].data() };
+        std::vector<float> out(n);
+
+        if (!isParameter(s.xAxis) && !isParameter(s.yAxis))
+        {
+            Presets::withConsts<float>(params, [&](const auto& k) {
+                ftleBatch<simd::vfloat>([&](int) -> const auto& { return k; }, state, n, s.dt, s.steps(), out.data());
+                });
+        }
+        else
+        {
+            // l1, l2, m1, m2, gravity of every pixel; the lanes past the last
+            // pixel repeat its parameters rather than divide by zero
+            std::vector<float> lanes[5];
+            for (int y = y0; y < y1; y++)
+                for (int x = x0; x < x1; x++)
+                {
+                    const SimParams p = s.paramsAt(params, x, y);
+                    const float values[5] = { p.l1, p.l2, p.m1, p.m2, p.gravity };
+                    for (int c = 0; c < 5; c++) lanes[c].push_back(values[c]);
+                }
+            for (std::vector<float>& c : lanes) c.resize((n + W - 1) / W * W, c.back());
+            ftleBatch<simd::vfloat>([&](int i) {
+                alignas(64) float v[5][W];
+                for (int c = 0; c < 5; c++)
+                    for (int l = 0; l < W; l++) v[c][l] = lanes[c][i + l];
+                return BasicPendulumConsts<simd::vfloat>(simd::vfloat::load(v[0]), simd::vfloat::load(v[1]),
+                    simd::vfloat::load(v[2]), simd::vfloat::load(v[3]), simd::vfloat::load(v[4]));
+                }, state, n, s.dt, s.steps(), out.data());
+        }
+
+        int i = 0;
+        for (int y = y0; y < y1; y++)
+            for (int x = x0; x < x1; x++)
+                band[(y - y0) * s.width + x] = out[i++];
+    }
+
+    // the whole map, one row of tiles at a time spread over the pool;
+    // rows(values, y0, count) gets each band as soon as it is done
+    template <typename Rows>
+    void render(const SimParams& params, const Settings& s, ThreadPool& pool, Rows&& rows)
+    {
+        const int tilesX = (s.width + s.tile - 1) / s.tile;
+        std::vector<float> band((size_t)s.tile * s.width);
+        for (int y0 = 0; y0 < s.height; y0 += s.tile)
+        {
+            const int y1 = y0 + s.tile < s.height ? y0 + s.tile : s.height;
+            pool.parallelFor(tilesX, 1, [&](int begin, int end) {
+                for (int tx = begin; tx < end; tx++)
+                {
+                    int x0 = tx * s.tile;
+                    int x1 = x0 + s.tile < s.width ? x0 + s.tile : s.width;
+                    renderTile(params, s, x0, y0, x1, y1, band.data());
+                }
+                });
+            rows(band.data(), y0, y1 - y0);
+        }
+    }
+
+    // PATH.f32 (raw native floats, row-major from the top left) and PATH.pgm
+    // (16-bit, 0 to displayMax mapped to black to white), written band by band
+    class Output
+    {
+    public:
+        ~Output() { close(); }
+
+        bool open(const std::string& base, int width_, int height, float displayMax_)
+        {
+            width = width_;
+            displayMax = displayMax_ > 0.0f ? displayMax_ : 1.0f;
+            raw = fopen((base + ".f32").c_str(), "wb");
+            pgm = fopen((base + ".pgm").c_str(), "wb");
+            good = raw && pgm && fprintf(pgm, "P5\n%d %d\n65535\n", width, height) > 0;
+            return good;
+        }
+
+        void write(const float* values, int rows)
+        {
+            if (!good) return;
+            size_t n = (size_t)rows * width;
+            good = fwrite(values, sizeof(float), n, raw) == n;
+            std::vector<unsigned char> bytes(2 * n);
+            for (size_t i = 0; i < n; i++)
+            {
+                double v = values[i] / displayMax;
+                unsigned shade = (unsigned)(65535.0 * (v < 0.0 ? 0.0 : v > 1.0 ? 1.0 : v) + 0.5);
+                bytes[2 * i] = (unsigned char)(shade >> 8);     // PGM samples are big-endian
+                bytes[2 * i + 1] = (unsigned char)(shade & 0xff);
+            }
+            good = good && fwrite(bytes.data(), 1, bytes.size(), pgm) == bytes.size();
+        }
+
+        // false if anything failed on the way
+        bool close()
+        {
+            if (raw) good = fclose(raw) == 0 && good;
+            if (pgm) good = fclose(pgm) == 0 && good;
+            raw = pgm = nullptr;
+            return good;
+        }
+
+    private:
+        FILE* raw = nullptr;
+        FILE* pgm = nullptr;
+        int width = 0;
+        float displayMax = 1.0f;
+        bool good = false;
+    };
+}
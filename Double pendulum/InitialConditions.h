@@ -0,0 +1,202 @@
+﻿#pragma once
+#include <math.h>
+#include <cmath>
+#include <cstdint>
+#include "SimdMath.h"
+
+// -------- initial conditions of the ensemble --------
+// Member i starts from state(i): theta1, theta2, omega1, omega2 around a
+// center, drawn by one of
+//   Ramp      theta2 grows by `step` per member, the rest at the center
+//   Uniform   uniformly in the box center +- spread
+//   Gaussian  normal around the center, spread = standard deviations
+//   Sobol     Sobol points in the box, digitally shifted by the seed
+//   Halton    Halton points (bases 2, 3, 5, 7) in the box, rotated by the seed
+// The random numbers come from Philox4x32-10 (Salmon et al. 2011), a
+// counter-based generator: the numbers of member i are a pure function of
+// (seed, i), so members can be generated in any order, on any number of
+// threads, with no state shared between them. The low-discrepancy points are
+// computed from i directly for the same reason.
+namespace initial
+{
+    enum class Generator
+    {
+        Ramp,
+        Uniform,
+        Gaussian,
+        Sobol,
+        Halton,
+        Count
+    };
+
+    inline const char* generatorName(Generator g)
+    {
+        switch (g)
+        {
+        case Generator::Ramp: return "ramp";
+        case Generator::Uniform: return "uniform";
+        case Generator::Gaussian: return "gaussian";
+        case Generator::Sobol: return "sobol";
+        case Generator::Halton: return "halton";
+        default: return "?";
+        }
+    }
+
+    // ---- Philox4x32-10 ----
+    // four 32-bit words from a 128-bit counter and a 64-bit key
+    inline void philox4x32(const uint32_t* counter, uint64_t key, uint32_t* out)
+    {
+        const uint32_t M0 = 0xD2511F53u, M1 = 0xCD9E8D57u;
+        const uint32_t W0 = 0x9E3779B9u, W1 = 0xBB67AE85u;
+        uint32_t c0 = counter[0], c1 = counter[1], c2 = counter[2], c3 = counter[3];
+        uint32_t k0 = (uint32_t)key, k1 = (uint32_t)(key >> 32);
+        for (int r = 0; r < 10; r++)
+        {
+            uint64_t p0 = (uint64_t)M0 * c0, p1 = (uint64_t)M1 * c2;
+            uint32_t n0 = (uint32_t)(p1 >> 32) ^ c1 ^ k0;
+            uint32_t n2 = (uint32_t)(p0 >> 32) ^ c3 ^ k1;
+            c0 = n0; c1 = (uint32_t)p1;
+            c2 = n2; c3 = (uint32_t)p0;
+            k0 += W0; k1 += W1;
+        }
+        out[0] = c0; out[1] = c1; out[2] = c2; out[3] = c3;
+    }
+
+    // words of block `block` of member i; blocks keep the uses of one seed apart
+    const uint32_t MEMBER_BLOCK = 0;
+    const uint32_t SHIFT_BLOCK = 1;
+
+    inline void randomWords(uint64_t seed, uint64_t i, uint32_t block, uint32_t* out)
+    {
+        const uint32_t counter[4] = { (uint32_t)i, (uint32_t)(i >> 32), block, 0 };
+        philox4x32(counter, seed, out);
+    }
+
+    // in (0, 1), never 0 so the Gaussian can take its log
+    inline double unit(uint32_t x) { return (x + 0.5) * (1.0 / 4294967296.0); }
+
+    // ---- Sobol ----
+    // direction numbers of the first four dimensions (Joe & Kuo 2008)
+    struct SobolDirections
+    {
+        uint32_t v[4][32];
+
+        SobolDirections()
+        {
+            // degree s, coefficients a and initial m of dimensions 2..4;
+            // dimension 1 is the van der Corput sequence
+            static const int s[3] = { 1, 2, 3 };
+            static const int a[3] = { 0, 1, 1 };
+            static const uint32_t m[3][3] = { { 1 }, { 1, 3 }, { 1, 3, 1 } };
+            for (int k = 0; k < 32; k++) v[0][k] = 1u << (31 - k);
+            for (int d = 1; d < 4; d++)
+            {
+                const int deg = s[d - 1];
+                for (int k = 0; k < 32; k++)
+                {
+                    if (k < deg)
+                    {
+                        v[d][k] = m[d - 1][k] << (31 - k);
+                        continue;
+                    }
+                    uint32_t x = v[d][k - deg] ^ (v[d][k - deg] >> deg);
+                    for (int j = 1; j < deg; j++)
+                        if ((a[d - 1] >> (deg - 1 - j)) & 1) x ^= v[d][k - j];
+                    v[d][k] = x;
+                }
+            }
+        }
+    };
+
+    inline const SobolDirections SOBOL_DIRECTIONS;
+
+    // point n of the 4D Sobol sequence as 32-bit fractions, straight from n
+    inline void sobol(uint32_t n, uint32_t* out)
+    {
+        uint32_t x0 = 0, x1 = 0, x2 = 0, x3 = 0;
+        for (int k = 0; n; k++, n >>= 1)
+            if (n & 1)
+            {
+                x0 ^= SOBOL_DIRECTIONS.v[0][k]; x1 ^= SOBOL_DIRECTIONS.v[1][k];
+                x2 ^= SOBOL_DIRECTIONS.v[2][k]; x3 ^= SOBOL_DIRECTIONS.v[3][k];
+            }
+        out[0] = x0; out[1] = x1; out[2] = x2; out[3] = x3;
+    }
+
+    // ---- Halton ----
+    inline double radicalInverse(uint32_t n, uint32_t base)
+    {
+        double inv = 1.0 / base, f = inv, r = 0.0;
+        for (; n; n /= base, f *= inv)
+            r += (double)(n % base) * f;
+        return r;
+    }
+
+    struct Settings
+    {
+        Generator generator = Generator::Ramp;
+        uint64_t seed = 0;
+        float center[4] = { 0.0f, 0.0f, 0.0f, 0.0f };  // theta1, theta2, omega1, omega2
+        float spread[4] = { 0.1f, 0.1f, 0.0f, 0.0f };  // box half-widths, standard deviations for Gaussian
+        float step = 0.012f;                            // Ramp: theta2 of member i is center + i * step
+
+        // start state of member i, a function of the settings and i alone
+        void state(uint64_t i, double* y) const
+        {
+            double u[4];
+            uint32_t w[4];
+            switch (generator)
+            {
+            case Generator::Uniform:
+                randomWords(seed, i, MEMBER_BLOCK, w);
+                for (int d = 0; d < 4; d++) u[d] = unit(w[d]);
+                break;
+            case Generator::Gaussian:
+            {
+                // Box-Muller, two normals from each pair of words
+                const double TWO_PI = 6.283185307179586;
+                randomWords(seed, i, MEMBER_BLOCK, w);
+                for (int d = 0; d < 4; d += 2)
+                {
+                    double r = sqrt(-2.0 * simd::scalarLog(unit(w[d])));
+                    double s, c;
+                    simd::sinCos(TWO_PI * unit(w[d + 1]), s, c);
+                    y[d] = center[d] + spread[d] * r * c;
+                    y[d + 1] = center[d + 1] + spread[d + 1] * r * s;
+                }
+                return;
+            }
+            case Generator::Sobol:
+            {
+                // point 0 is the corner of the box, start at 1
+                uint32_t shift[4];
+                randomWords(seed, 0, SHIFT_BLOCK, shift);
+                sobol((uint32_t)(i + 1), w);
+                for (int d = 0; d < 4; d++) u[d] = unit(w[d] ^ shift[d]);
+                break;
+            }
+            case Generator::Halton:
+            {
+                static const uint32_t bases[4] = { 2, 3, 5, 7 };
+                uint32_t shift[4];
+                randomWords(seed, 0, SHIFT_BLOCK, shift);
+                for (int d = 0; d < 4; d++)
+                {
+                    double h = radicalInverse((uint32_t)(i + 1), bases[d]) + unit(shift[d]);
+                    u[d] = h < 1.0 ? h : h - 1.0;
+                }
+                break;
+            }
+            default:
+                // float arithmetic, as the ramp always was
+                y[0] = center[0];
+                y[1] = center[1] + (float)i * step;
+                y[2] = center[2];
+                y[3] = center[3];
+                return;
+            }
+            for (int d = 0; d < 4; d++)
+                y[d] = center[d] + spread[d] * (2.0 * u[d] - 1.0);
+        }
+    };
+}
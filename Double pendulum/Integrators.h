@@ -0,0 +1,181 @@
+﻿#pragma once
+#include <math.h>
+#include <cmath>
+#include <limits>
+#include <type_traits>
+#include "SimdMath.h"
+#include "Dual.h"
+
+// -------- integrator family --------
+// RK4 is the original explicit scheme. The others work on the canonical
+// momenta p1, p2 of the Hamiltonian
+//   H = (m2 l2^2 p1^2 + (m1+m2) l1^2 p2^2 - 2 m2 l1 l2 p1 p2 cos(d))
+//       / (2 m2 l1^2 l2^2 (m1 + m2 sin^2(d)))
+//       - (m1+m2) g l1 cos(th1) - m2 g l2 cos(th2),      d = th1 - th2
+// and are symplectic and symmetric: stepping with -dt undoes a step with dt up
+// to rounding and the fixed-point solver tolerance, and energy errors stay
+// bounded instead of drifting.
+enum class Integrator
+{
+    RK4,
+    StormerVerlet,      // generalized leapfrog, 2nd order
+    ImplicitMidpoint,   // 2nd order
+    Yoshida4,           // triple-jump composition of Stormer-Verlet
+    Yoshida6,           // 7-stage composition of Stormer-Verlet
+    DormandPrince45,    // adaptive, per-trajectory error control (DormandPrince.h)
+    Taylor,             // adaptive order and step, for reference runs (Taylor.h)
+    Count
+};
+
+inline const char* integratorName(Integrator method)
+{
+    switch (method)
+    {
+    case Integrator::RK4: return "RK4";
+    case Integrator::StormerVerlet: return "Stormer-Verlet";
+    case Integrator::ImplicitMidpoint: return "Implicit midpoint";
+    case Integrator::Yoshida4: return "Yoshida 4";
+    case Integrator::Yoshida6: return "Yoshida 6";
+    case Integrator::DormandPrince45: return "Dormand-Prince 4(5)";
+    case Integrator::Taylor: return "Taylor series";
+    default: return "?";
+    }
+}
+
+inline bool isSymplectic(Integrator method)
+{
+    return method != Integrator::RK4 && method != Integrator::DormandPrince45 && method != Integrator::Taylor;
+}
+
+template <typename T>
+struct DoublePendulumHamiltonian
+{
+    T l1, l2, m1, m2, g;
+
+    // the implicit stages iterate until the update is below a few ulp. On
+    // duals (the Lyapunov tangents) only the values are tested, so they take
+    // the same iterations as on T; the derivatives converge at the same rate.
+    static const int MAX_ITERATIONS = 30;
+
+    static bool converged(const T& delta, const T& value)
+    {
+        using std::fabs;
+        typedef typename std::decay<decltype(primal(delta))>::type S;
+        return fabs(primal(delta)) <= 4 * std::numeric_limits<S>::epsilon() * (1.0f + fabs(primal(value)));
+    }
+
+    // p = M(q) * omega
+    void momenta(T th1, T th2, T w1, T w2, T& p1, T& p2) const
+    {
+        T c = simd::scalarCos(T(th1 - th2));
+        p1 = (m1 + m2) * l1 * l1 * w1 + m2 * l1 * l2 * w2 * c;
+        p2 = m2 * l2 * l2 * w2 + m2 * l1 * l2 * w1 * c;
+    }
+
+    // omega = dH/dp
+    void velocities(T th1, T th2, T p1, T p2, T& w1, T& w2) const
+    {
+        T s, c;
+        simd::sinCos(T(th1 - th2), s, c);
+        T den = m1 + m2 * s * s;
+        w1 = (l2 * p1 - l1 * p2 * c) / (l1 * l1 * l2 * den);
+        w2 = ((m1 + m2) * l1 * p2 - m2 * l2 * p1 * c) / (m2 * l1 * l2 * l2 * den);
+    }
+
+    // -dH/dq
+    void forces(T th1, T th2, T p1, T p2, T& f1, T& f2) const
+    {
+        T s, c;
+        simd::sinCos(T(th1 - th2), s, c);
+        T den = m1 + m2 * s * s;
+        T C1 = p1 * p2 * s / (l1 * l2 * den);
+        T C2 = (m2 * l2 * l2 * p1 * p1 + (m1 + m2) * l1 * l1 * p2 * p2 - 2 * m2 * l1 * l2 * p1 * p2 * c)
+            * (2 * s * c) / (2 * l1 * l1 * l2 * l2 * den * den);
+        f1 = -(m1 + m2) * g * l1 * simd::scalarSin(th1) - C1 + C2;
+        f2 = -m2 * g * l2 * simd::scalarSin(th2) + C1 - C2;
+    }
+
+    // generalized Stormer-Verlet for a non-separable H:
+    //   p' = p + h/2 F(q, p')                       (implicit in p')
+    //   Q  = q + h/2 (V(q, p') + V(Q, p'))          (implicit in Q)
+    //   P  = p' + h/2 F(Q, p')
+    void stepStormerVerlet(T& th1, T& th2, T& p1, T& p2, T h) const
+    {
+        T f1, f2, v1, v2;
+
+        T hp1 = p1, hp2 = p2;
+        for (int it = 0; it < MAX_ITERATIONS; it++)
+        {
+            forces(th1, th2, hp1, hp2, f1, f2);
+            T n1 = p1 + 0.5f * h * f1, n2 = p2 + 0.5f * h * f2;
+            bool done = converged(n1 - hp1, n1) && converged(n2 - hp2, n2);
+            hp1 = n1; hp2 = n2;
+            if (done) break;
+        }
+
+        T a1, a2;
+        velocities(th1, th2, hp1, hp2, a1, a2);
+        T q1 = th1 + h * a1, q2 = th2 + h * a2;
+        for (int it = 0; it < MAX_ITERATIONS; it++)
+        {
+            velocities(q1, q2, hp1, hp2, v1, v2);
+            T n1 = th1 + 0.5f * h * (a1 + v1), n2 = th2 + 0.5f * h * (a2 + v2);
+            bool done = converged(n1 - q1, n1) && converged(n2 - q2, n2);
+            q1 = n1; q2 = n2;
+            if (done) break;
+        }
+
+        forces(q1, q2, hp1, hp2, f1, f2);
+        th1 = q1; th2 = q2;
+        p1 = hp1 + 0.5f * h * f1;
+        p2 = hp2 + 0.5f * h * f2;
+    }
+
+    // z' = z + h f((z + z') / 2), solved for the midpoint
+    void stepImplicitMidpoint(T& th1, T& th2, T& p1, T& p2, T h) const
+    {
+        T mq1 = th1, mq2 = th2, mp1 = p1, mp2 = p2;
+        for (int it = 0; it < MAX_ITERATIONS; it++)
+        {
+            T v1, v2, f1, f2;
+            velocities(mq1, mq2, mp1, mp2, v1, v2);
+            forces(mq1, mq2, mp1, mp2, f1, f2);
+            T n1 = th1 + 0.5f * h * v1, n2 = th2 + 0.5f * h * v2;
+            T n3 = p1 + 0.5f * h * f1, n4 = p2 + 0.5f * h * f2;
+            bool done = converged(n1 - mq1, n1) && converged(n2 - mq2, n2)
+                && converged(n3 - mp1, n3) && converged(n4 - mp2, n4);
+            mq1 = n1; mq2 = n2; mp1 = n3; mp2 = n4;
+            if (done) break;
+        }
+        th1 = 2 * mq1 - th1; th2 = 2 * mq2 - th2;
+        p1 = 2 * mp1 - p1; p2 = 2 * mp2 - p2;
+    }
+
+    // symmetric composition of Stormer-Verlet sub-steps w[0..n) * h
+    void stepComposition(T& th1, T& th2, T& p1, T& p2, T h,
+        const double* w, int n) const
+    {
+        for (int i = 0; i < n; i++)
+            stepStormerVerlet(th1, th2, p1, p2, T(w[i]) * h);
+    }
+
+    void step(Integrator method, T& th1, T& th2, T& p1, T& p2, T h) const
+    {
+        // Yoshida (1990): triple jump and the 6th order "solution A"
+        static const double Y4_1 = 1.0 / (2.0 - 1.2599210498948732);
+        static const double Y4_0 = -1.2599210498948732 / (2.0 - 1.2599210498948732);
+        static const double Y4[3] = { Y4_1, Y4_0, Y4_1 };
+        static const double Y6_1 = -1.17767998417887, Y6_2 = 0.235573213359357, Y6_3 = 0.784513610477560;
+        static const double Y6_0 = 1.0 - 2.0 * (Y6_1 + Y6_2 + Y6_3);
+        static const double Y6[7] = { Y6_3, Y6_2, Y6_1, Y6_0, Y6_1, Y6_2, Y6_3 };
+
+        switch (method)
+        {
+        case Integrator::StormerVerlet: stepStormerVerlet(th1, th2, p1, p2, h); break;
+        case Integrator::ImplicitMidpoint: stepImplicitMidpoint(th1, th2, p1, p2, h); break;
+        case Integrator::Yoshida4: stepComposition(th1, th2, p1, p2, h, Y4, 3); break;
+        case Integrator::Yoshida6: stepComposition(th1, th2, p1, p2, h, Y6, 7); break;
+        default: break;
+        }
+    }
+};
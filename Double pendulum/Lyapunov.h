@@ -0,0 +1,161 @@
+﻿#pragma once
+#include <math.h>
+#include <cmath>
+#include "Dual.h"
+#include "Pendulum.h"
+#include "PendulumKernels.h"
+#include "Integrators.h"
+
+// -------- Lyapunov spectrum and MEGNO --------
+// Every member carries four tangent vectors v0..v3 of the state
+// (theta1, theta2, omega1, omega2). They advance with the same step as the
+// state, whichever method takes it: the step runs on Dual<T, 4> numbers
+// seeded with the tangents, so the values come out as without tangents and
+// the derivative parts as the tangents pushed through the linearised step.
+// Every `interval` steps the tangents are orthonormalised by modified
+// Gram-Schmidt; the log of the norms they had accumulates into the spectrum
+//   lambda_j = sum of log |v_j| / t
+// and the growth of v0 drives MEGNO, the mean exponential growth of nearby
+// orbits (Cincotta & Simo 2000), discretised on the same intervals:
+//   Y(t) = 2/t * sum over intervals of (interval midpoint * log |v0|)
+//   mean Y(t) = 1/t * integral of Y
+// mean Y tends to 2 on regular (quasi-periodic) orbits and grows like
+// lambda_0 * t / 2 on chaotic ones.
+namespace lyapunov
+{
+    const int DIM = 4;
+
+    // mean Y above this marks a member as chaotic in ChaosStats
+    const double MEGNO_CHAOTIC = 4.0;
+
+    // The tangents ride along with RK4 and the symplectic methods. Dormand-
+    // Prince and the Taylor series would need duals inside their step size
+    // control, so with them the tangents stand still.
+    inline bool supports(Integrator method)
+    {
+        return method != Integrator::DormandPrince45 && method != Integrator::Taylor;
+    }
+
+    // when the tangents of one step() call are due for Gram-Schmidt: after
+    // step c (counted from 1) once c >= first, then every `interval` steps.
+    // Times are the integrated time since the reset.
+    struct Schedule
+    {
+        int first, interval;
+        double start;       // time before the call
+        double stepTime;    // |dt|
+        double last;        // time of the last Gram-Schmidt before the call
+
+        Schedule(int interval, int sinceLast, double start, double stepTime, double last)
+            : first(interval - sinceLast > 1 ? interval - sinceLast : 1), interval(interval),
+            start(start), stepTime(stepTime), last(last) {}
+
+        bool due(int c) const { return c >= first && (c - first) % interval == 0; }
+        double at(int c) const { return start + stepTime * c; }
+        // time of the Gram-Schmidt before the one due after step c
+        double before(int c) const { return c == first ? last : at(c - interval); }
+
+        // steps since the last Gram-Schmidt and its time, after `steps` steps
+        void finish(int steps, int& sinceLast, double& lastTime) const
+        {
+            if (steps < first)
+            {
+                sinceLast += steps;
+                return;
+            }
+            int c = first + (steps - first) / interval * interval;
+            sinceLast = steps - c;
+            lastTime = at(c);
+        }
+    };
+
+    // stepRK4CompensatedBatch on Dual<V, DIM>: the values step exactly as
+    // there (compensated, angles wrapped), the derivative parts are the
+    // tangents pushed through the linearised step. The tangents are in
+    // sixteen columns, tangent[4 * j + c] holding component c of vector j,
+    // padded like the state's. After every step observe(i, s, old state,
+    // new state) sees the values, as stepRK4CompensatedBatch's, then
+    // renormalize(i, s, x) may replace the derivative parts of x[0..DIM).
+    template <typename V, typename K, typename O, typename R>
+    inline void stepTangentCompensatedBatch(float* const* state, float* const* tangent, float* const* carry,
+        int* winding1, int* winding2, int count, float dt, int steps, const K& k, O&& observe, R&& renormalize)
+    {
+        typedef Dual<V, DIM> D;
+        const D h = V(dt), half = V(0.5f * dt), sixth = V(dt / 6.0f);
+        for (int i = 0; i < count; i += V::width)
+        {
+            D x[DIM];
+            V cx[DIM];
+            for (int c = 0; c < DIM; c++)
+            {
+                x[c].v = V::load(state[c] + i);
+                cx[c] = V::load(carry[c] + i);
+                for (int j = 0; j < DIM; j++) x[c].d[j] = V::load(tangent[DIM * j + c] + i);
+            }
+            V turns1(0.0f), turns2(0.0f);
+
+            for (int s = 0; s < steps; s++)
+            {
+                V old[DIM] = { x[0].v, x[1].v, x[2].v, x[3].v };
+                D dx[DIM];
+                rk4IncrementBatch(x[0], x[1], x[2], x[3], h, half, sixth, k, dx[0], dx[1], dx[2], dx[3]);
+                for (int c = 0; c < DIM; c++)
+                {
+                    addCompensated(x[c].v, cx[c], dx[c].v);
+                    for (int j = 0; j < DIM; j++) x[c].d[j] = x[c].d[j] + dx[c].d[j];
+                }
+                observe(i, s, old[0], old[1], old[2], old[3], x[0].v, x[1].v, x[2].v, x[3].v);
+                wrapAngle(x[0].v, cx[0], turns1);
+                wrapAngle(x[1].v, cx[1], turns2);
+                renormalize(i, s, x);
+            }
+
+            for (int c = 0; c < DIM; c++)
+            {
+                x[c].v.store(state[c] + i);
+                cx[c].store(carry[c] + i);
+                for (int j = 0; j < DIM; j++) x[c].d[j].store(tangent[DIM * j + c] + i);
+            }
+            alignas(64) float t1[V::width], t2[V::width];
+            turns1.store(t1);
+            turns2.store(t2);
+            for (int l = 0; l < V::width; l++)
+            {
+                winding1[i + l] += (int)t1[l];
+                winding2[i + l] += (int)t2[l];
+            }
+        }
+    }
+
+    // modified Gram-Schmidt on v[0..DIM), in place; logNorm[j] gets the log of
+    // the length v[j] had after removing the earlier directions
+    inline void orthonormalize(double (*v)[DIM], double* logNorm)
+    {
+        for (int j = 0; j < DIM; j++)
+        {
+            for (int p = 0; p < j; p++)
+            {
+                double dot = 0.0;
+                for (int c = 0; c < DIM; c++) dot += v[j][c] * v[p][c];
+                for (int c = 0; c < DIM; c++) v[j][c] -= dot * v[p][c];
+            }
+            double norm = 0.0;
+            for (int c = 0; c < DIM; c++) norm += v[j][c] * v[j][c];
+            norm = sqrt(norm);
+            logNorm[j] = simd::scalarLog(norm);
+            double inv = norm > 0.0 ? 1.0 / norm : 0.0;
+            for (int c = 0; c < DIM; c++) v[j][c] *= inv;
+        }
+    }
+}
+
+// spectrum and MEGNO over the live members
+struct ChaosStats
+{
+    double spectrum[lyapunov::DIM] = {};    // mean exponents, largest first
+    double maxExponent = 0.0;               // largest lambda_0 of any member
+    double megno = 0.0;                     // mean of mean Y
+    int chaotic = 0;                        // members with mean Y > MEGNO_CHAOTIC
+    int members = 0;
+    double time = 0.0;                      // time the tangents have been integrated
+};
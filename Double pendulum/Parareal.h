@@ -0,0 +1,150 @@
+﻿#pragma once
+#include <math.h>
+#include <cmath>
+#include <vector>
+#include "Pendulum.h"
+#include "ThreadPool.h"
+
+// -------- Parareal: one trajectory, parallel in time --------
+// The run is cut into windows and each window into `slices` equal pieces.
+// A coarse propagator G (RK4 with coarseRatio times the step) sweeps the
+// window serially; then every iteration runs the fine propagator F (RK4 with
+// the step dt, the serial answer) on all slices in parallel and corrects the
+// slice boundaries serially (Lions, Maday & Turinici 2001):
+//   U[n+1] = G(U'[n]) + F(U[n]) - G(U[n])
+// where U' is this iteration's value and U the last one. A boundary whose
+// start did not change takes F(U[n]) directly, so the first k boundaries are
+// bit for bit the serial ones after k iterations and a window converged all
+// the way reproduces the serial run exactly. With tolerance > 0 iterations
+// stop as soon as no boundary moves by more than that; the next window starts
+// from the last boundary.
+// Speedup is about slices / iterations. Regular motion converges to 1e-12 in
+// 2-3 iterations per window of 1000 s; chaotic motion needs nearly as many
+// iterations as slices (the coarse error grows like exp(lambda t)), so there
+// Parareal mostly buys the bit-exact check, and a windowed run that stops on
+// the tolerance differs from the serial one by that error amplified.
+namespace parareal
+{
+    struct Settings
+    {
+        long long steps = 1000000;      // fine steps in all
+        double dt = 0.01;
+        long long window = 100000;      // fine steps per window, 0 = the whole run
+        int slices = 0;                 // per window, 0 = one per pool thread
+        int coarseRatio = 10;           // coarse step = coarseRatio * dt
+        double tolerance = 1e-12;       // largest boundary change that counts as converged, 0 = exact
+        int maxIterations = 0;          // per window, 0 = slices (always converges)
+    };
+
+    struct Report
+    {
+        int windows = 0;
+        int iterations = 0;         // summed over the windows
+        int exactWindows = 0;       // windows that reproduced the serial run bit for bit
+        double lastChange = 0.0;    // largest boundary change in the last iteration
+    };
+
+    // RK4 of the state y = { theta1, theta2, omega1, omega2 }
+    template <typename T>
+    inline void propagate(T* y, long long steps, T h, const BasicPendulumConsts<T>& k)
+    {
+        for (long long s = 0; s < steps; s++)
+            stepRK4<T>(y[0], y[1], y[2], y[3], h, k);
+    }
+
+    // the serial answer, for comparison
+    template <typename T>
+    inline void serial(const SimParams& params, const Settings& s, T* y)
+    {
+        propagate(y, s.steps, T(s.dt), BasicPendulumConsts<T>(params));
+    }
+
+    template <typename T>
+    struct State
+    {
+        T y[4];
+
+        // compared by value: long double has padding bytes
+        bool operator==(const State& o) const
+        {
+            return y[0] == o.y[0] && y[1] == o.y[1] && y[2] == o.y[2] && y[3] == o.y[3];
+        }
+    };
+
+    template <typename T>
+    inline Report run(const SimParams& params, const Settings& s, T* y, ThreadPool& pool)
+    {
+        const BasicPendulumConsts<T> k(params);
+        const int slices = s.slices > 0 ? s.slices : pool.size();
+        const int maxIterations = s.maxIterations > 0 ? s.maxIterations : slices;
+        const long long window = s.window > 0 ? s.window : s.steps;
+
+        std::vector<long long> length(slices);
+        std::vector<State<T>> u(slices + 1), uNew(slices + 1), f(slices), g(slices);
+        Report report;
+
+        // G over slice n: its length in as few coarse steps as coarseRatio allows
+        auto coarse = [&](State<T> x, int n) {
+            long long m = (length[n] + s.coarseRatio - 1) / s.coarseRatio;
+            if (m > 0) propagate(x.y, m, T(s.dt * (double)length[n] / (double)m), k);
+            return x;
+        };
+
+        for (long long done = 0; done < s.steps; done += window)
+        {
+            const long long steps = s.steps - done < window ? s.steps - done : window;
+            for (int n = 0; n < slices; n++)
+                length[n] = steps / slices + (n < steps % slices ? 1 : 0);
+
+            // iteration 0: the coarse sweep
+            for (int j = 0; j < 4; j++) u[0].y[j] = y[j];
+            for (int n = 0; n < slices; n++)
+                u[n + 1] = g[n] = coarse(u[n], n);
+
+            int exact = 0;      // u[0..exact] are the serial values
+            int iteration = 0;
+            double change = 0.0;
+            while (exact < slices && iteration < maxIterations)
+            {
+                iteration++;
+                pool.parallelFor(slices - exact, 1, [&](int begin, int end) {
+                    for (int n = exact + begin; n < exact + end; n++)
+                    {
+                        f[n] = u[n];
+                        propagate(f[n].y, length[n], T(s.dt), k);
+                    }
+                    });
+
+                change = 0.0;
+                uNew[exact] = u[exact];
+                int nextExact = exact;
+                for (int n = exact; n < slices; n++)
+                {
+                    if (uNew[n] == u[n])
+                    {
+                        uNew[n + 1] = f[n];
+                        if (nextExact == n) nextExact = n + 1;
+                    }
+                    else
+                    {
+                        State<T> gNew = coarse(uNew[n], n);
+                        for (int j = 0; j < 4; j++) uNew[n + 1].y[j] = gNew.y[j] + (f[n].y[j] - g[n].y[j]);
+                        g[n] = gNew;
+                    }
+                    for (int j = 0; j < 4; j++)
+                        change = fmax(change, fabs((double)(uNew[n + 1].y[j] - u[n + 1].y[j])));
+                }
+                for (int n = exact; n <= slices; n++) u[n] = uNew[n];
+                exact = nextExact;
+                if (s.tolerance > 0.0 && change <= s.tolerance) break;
+            }
+
+            for (int j = 0; j < 4; j++) y[j] = u[slices].y[j];
+            report.windows++;
+            report.iterations += iteration;
+            report.exactWindows += exact == slices;
+            report.lastChange = change;
+        }
+        return report;
+    }
+}
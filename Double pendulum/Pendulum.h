@@ -2,35 +2,134 @@
 #include <GLFW/glfw3.h>
 #include <vector>
 #include <math.h>
+#include <cmath>
+#include "SimParams.h"
+#include "SimdMath.h"
 
-// -------- shared controls (defined in main.cpp) --------
+// -------- shared display controls (defined in main.cpp) --------
+// Physical parameters reach the simulation through SimParams instead.
 extern bool g_showPendulums;
 extern bool g_showTrails;
 extern bool g_pause;
+// ---------------------------------------------------------------
+
+// Everything below is templated on the scalar type T (float, double,
+// long double or DoubleDouble). sin/cos go through simd::sinCos(), which
+// finds user-defined scalar types by ADL and pins float to one polynomial in
+// deterministic builds.
+
+// angular accelerations of the double pendulum, shared by every integrator.
+// Four trig calls per evaluation, the others follow from
+//   sin(th1 - 2*th2) = sin(2d - th1) with d = th1 - th2
+//   cos(2*th1 - 2*th2) = cos(d)^2 - sin(d)^2
+// K is BasicPendulumConsts<T> or a compile-time StaticPendulumConsts (Presets.h).
+template <typename T, typename K>
+inline void accelerations(T th1, T th2, T w1, T w2,
+    const K& k, T& a1, T& a2)
+{
+    T s1, c1, sd, cd;
+    simd::sinCos(th1, s1, c1);
+    simd::sinCos(T(th1 - th2), sd, cd);
+    T s2d = 2 * sd * cd;
+    T c2d = cd * cd - sd * sd;
+    T sTh1Minus2Th2 = s2d * c1 - c2d * s1;
+
+    T w1sq = w1 * w1;
+    T w2sq = w2 * w2;
+    T den = k.twoM1PlusM2 - k.m2 * c2d;
+
+    T num1 = -k.gTwoM1PlusM2 * s1 - k.gM2 * sTh1Minus2Th2;
+    T num2 = -2 * sd * k.m2 * (w2sq * k.l2 + w1sq * k.l1 * cd);
+    a1 = (num1 + num2) / den * k.invL1;
+
+    T num3 = w1sq * k.l1M1PlusM2 + k.gM1PlusM2 * c1 + w2sq * k.l2M2 * cd;
+    a2 = 2 * sd * num3 / den * k.invL2;
+}
+
+template <typename T>
+inline void accelerations(T th1, T th2, T w1, T w2,
+    T l1, T l2, T m1, T m2, T gravity, T& a1, T& a2)
+{
+    accelerations(th1, th2, w1, w2, BasicPendulumConsts<T>(l1, l2, m1, m2, gravity), a1, a2);
+}
+
+// one RK4 step of the double pendulum equations of motion, shared by
+// Pendulum and PendulumEnsemble
+template <typename T, typename K>
+inline void stepRK4(T& theta1, T& theta2, T& omega1, T& omega2,
+    T dt, const K& k)
+{
+    auto accel = [&](T th1, T th2, T w1, T w2, T& a1, T& a2) {
+        accelerations(th1, th2, w1, w2, k, a1, a2);
+        };
 
-extern float g_l1;
-extern float g_l2;
-extern float g_m1;
-extern float g_m2;
-extern float g_gravity;
-// ------------------------------------------------------
+    // store original state
+    T th1 = theta1, th2 = theta2;
+    T w1 = omega1, w2 = omega2;
+    T a1, a2;
+
+    // --- k1 ---
+    accel(th1, th2, w1, w2, a1, a2);
+    T k1_th1 = w1;
+    T k1_th2 = w2;
+    T k1_w1 = a1;
+    T k1_w2 = a2;
+
+    // --- k2 ---
+    accel(th1 + 0.5f * k1_th1 * dt, th2 + 0.5f * k1_th2 * dt,
+        w1 + 0.5f * k1_w1 * dt, w2 + 0.5f * k1_w2 * dt, a1, a2);
+    T k2_th1 = w1 + 0.5f * k1_w1 * dt;
+    T k2_th2 = w2 + 0.5f * k1_w2 * dt;
+    T k2_w1 = a1;
+    T k2_w2 = a2;
+
+    // --- k3 ---
+    accel(th1 + 0.5f * k2_th1 * dt, th2 + 0.5f * k2_th2 * dt,
+        w1 + 0.5f * k2_w1 * dt, w2 + 0.5f * k2_w2 * dt, a1, a2);
+    T k3_th1 = w1 + 0.5f * k2_w1 * dt;
+    T k3_th2 = w2 + 0.5f * k2_w2 * dt;
+    T k3_w1 = a1;
+    T k3_w2 = a2;
+
+    // --- k4 ---
+    accel(th1 + k3_th1 * dt, th2 + k3_th2 * dt,
+        w1 + k3_w1 * dt, w2 + k3_w2 * dt, a1, a2);
+    T k4_th1 = w1 + k3_w1 * dt;
+    T k4_th2 = w2 + k3_w2 * dt;
+    T k4_w1 = a1;
+    T k4_w2 = a2;
+
+    // --- combine ---
+    theta1 += dt / 6.0f * (k1_th1 + 2 * k2_th1 + 2 * k3_th1 + k4_th1);
+    theta2 += dt / 6.0f * (k1_th2 + 2 * k2_th2 + 2 * k3_th2 + k4_th2);
+    omega1 += dt / 6.0f * (k1_w1 + 2 * k2_w1 + 2 * k3_w1 + k4_w1);
+    omega2 += dt / 6.0f * (k1_w2 + 2 * k2_w2 + 2 * k3_w2 + k4_w2);
+}
+
+template <typename T>
+inline void stepRK4(T& theta1, T& theta2, T& omega1, T& omega2,
+    T dt, T l1, T l2, T m1, T m2, T gravity)
+{
+    stepRK4(theta1, theta2, omega1, omega2, dt, BasicPendulumConsts<T>(l1, l2, m1, m2, gravity));
+}
 
-class Pendulum
+template <typename T>
+class BasicPendulum
 {
 public:
-    const float PI = 3.14159265358979323846f;
+    const T PI = T(3.14159265358979323846);
 
-    float l1 = 100.0f;
-    float l2 = 100.0f;
-    float m1 = 30.0f;
-    float m2 = 10.0f;
+    T l1 = 100.0f;
+    T l2 = 100.0f;
+    T m1 = 30.0f;
+    T m2 = 10.0f;
 
-    float theta1 = 0.0f;
-    float theta2 = PI / 3.0f;
-    float omega1 = 0.0f;
-    float omega2 = 0.0f;
-    float accel1 = 0.0f;
-    float accel2 = 0.0f;
+    T theta1 = 0.0f;
+    T theta2 = PI / 3.0f;
+    T omega1 = 0.0f;
+    T omega2 = 0.0f;
+    T accel1 = 0.0f;
+    T accel2 = 0.0f;
 
     struct Color { float r, g, b; };
     Color trailColor{ 1, 1, 1 };
@@ -39,7 +138,7 @@ public:
     std::vector<TrailPoint> trail;
     const int MAX_TRAIL = 100;
 
-    Pendulum(float offset, float hue)
+    BasicPendulum(T offset, float hue)
     {
         theta2 += offset;
         trailColor = {
@@ -49,7 +148,7 @@ public:
         };
     }
 
-	Pendulum(float initial_theta1, float initial_theta2, float hue) {
+	BasicPendulum(T initial_theta1, T initial_theta2, float hue) {
 		theta1 = initial_theta1;
 		theta2 = initial_theta2;
         trailColor = {
@@ -59,71 +158,12 @@ public:
         };
     }
 
-    void updateMotionRK4(float dt)
+    void updateMotionRK4(T dt, SimParams params)
     {
-        if (g_pause) return;
-
-        l1 = g_l1; l2 = g_l2;
-        m1 = g_m1; m2 = g_m2;
-
-        // helper lambda to compute accelerations
-        auto accel = [&](float th1, float th2, float w1, float w2, float& a1, float& a2) {
-            float num1 = -g_gravity * (2 * m1 + m2) * sin(th1);
-            float num2 = -m2 * g_gravity * sin(th1 - 2 * th2);
-            float num3 = -2 * sin(th1 - th2) * m2;
-            float num4 = w2 * w2 * l2 + w1 * w1 * l1 * cos(th1 - th2);
-            float den = l1 * (2 * m1 + m2 - m2 * cos(2 * th1 - 2 * th2));
-            a1 = (num1 + num2 + num3 * num4) / den;
-
-            num1 = 2 * sin(th1 - th2);
-            num2 = w1 * w1 * l1 * (m1 + m2);
-            num3 = g_gravity * (m1 + m2) * cos(th1);
-            num4 = w2 * w2 * l2 * m2 * cos(th1 - th2);
-            den = l2 * (2 * m1 + m2 - m2 * cos(2 * th1 - 2 * th2));
-            a2 = (num1 * (num2 + num3 + num4)) / den;
-            };
-
-        // store original state
-        float th1 = theta1, th2 = theta2;
-        float w1 = omega1, w2 = omega2;
-        float a1, a2;
-
-        // --- k1 ---
-        accel(th1, th2, w1, w2, a1, a2);
-        float k1_th1 = w1;
-        float k1_th2 = w2;
-        float k1_w1 = a1;
-        float k1_w2 = a2;
-
-        // --- k2 ---
-        accel(th1 + 0.5f * k1_th1 * dt, th2 + 0.5f * k1_th2 * dt,
-            w1 + 0.5f * k1_w1 * dt, w2 + 0.5f * k1_w2 * dt, a1, a2);
-        float k2_th1 = w1 + 0.5f * k1_w1 * dt;
-        float k2_th2 = w2 + 0.5f * k1_w2 * dt;
-        float k2_w1 = a1;
-        float k2_w2 = a2;
-
-        // --- k3 ---
-        accel(th1 + 0.5f * k2_th1 * dt, th2 + 0.5f * k2_th2 * dt,
-            w1 + 0.5f * k2_w1 * dt, w2 + 0.5f * k2_w2 * dt, a1, a2);
-        float k3_th1 = w1 + 0.5f * k2_w1 * dt;
-        float k3_th2 = w2 + 0.5f * k2_w2 * dt;
-        float k3_w1 = a1;
-        float k3_w2 = a2;
-
-        // --- k4 ---
-        accel(th1 + k3_th1 * dt, th2 + k3_th2 * dt,
-            w1 + k3_w1 * dt, w2 + k3_w2 * dt, a1, a2);
-        float k4_th1 = w1 + k3_w1 * dt;
-        float k4_th2 = w2 + k3_w2 * dt;
-        float k4_w1 = a1;
-        float k4_w2 = a2;
-
-        // --- combine ---
-        theta1 += dt / 6.0f * (k1_th1 + 2 * k2_th1 + 2 * k3_th1 + k4_th1);
-        theta2 += dt / 6.0f * (k1_th2 + 2 * k2_th2 + 2 * k3_th2 + k4_th2);
-        omega1 += dt / 6.0f * (k1_w1 + 2 * k2_w1 + 2 * k3_w1 + k4_w1);
-        omega2 += dt / 6.0f * (k1_w2 + 2 * k2_w2 + 2 * k3_w2 + k4_w2);
+        l1 = T(params.l1); l2 = T(params.l2);
+        m1 = T(params.m1); m2 = T(params.m2);
+
+        stepRK4<T>(theta1, theta2, omega1, omega2, dt, BasicPendulumConsts<T>(params));
     }
 
     void updateTrail(float x, float y)
@@ -153,10 +193,11 @@ public:
         drawTrail();
         if (!g_showPendulums) return;
 
-        float x2 = cx + l1 * sin(theta1);
-        float y2 = cy - l1 * cos(theta1);
-        float x3 = x2 + l2 * sin(theta2);
-        float y3 = y2 - l2 * cos(theta2);
+        float th1 = (float)theta1, th2 = (float)theta2;
+        float x2 = cx + (float)l1 * sinf(th1);
+        float y2 = cy - (float)l1 * cosf(th1);
+        float x3 = x2 + (float)l2 * sinf(th2);
+        float y3 = y2 - (float)l2 * cosf(th2);
 
         glColor3f(1, 1, 1);
         glBegin(GL_LINES);
@@ -171,3 +212,5 @@ public:
         glEnd();
     }
 };
+
+typedef BasicPendulum<float> Pendulum;
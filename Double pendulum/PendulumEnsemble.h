@@ -0,0 +1,1399 @@
+﻿#pragma once
+#include <GLFW/glfw3.h>
+#include <new>
+#include <cstring>
+#include <math.h>
+#include <type_traits>
+#include <variant>
+#include "Pendulum.h"
+#include "PendulumKernels.h"
+#include "Integrators.h"
+#include "DormandPrince.h"
+#include "Taylor.h"
+#include "DoubleDouble.h"
+#include "Presets.h"
+#include "Events.h"
+#include "Energy.h"
+#include "Lyapunov.h"
+#include "Checkpoint.h"
+#include "ThreadPool.h"
+
+// -------- 64-byte aligned column of plain values --------
+// T must be trivially copyable: columns are moved around with memcpy.
+template <typename T>
+class AlignedArray
+{
+public:
+    static const size_t ALIGNMENT = 64;
+
+    AlignedArray() = default;
+    AlignedArray(const AlignedArray& other) { *this = other; }
+    ~AlignedArray() { release(); }
+
+    AlignedArray& operator=(const AlignedArray& other)
+    {
+        if (this == &other) return *this;
+        resize(other.count);
+        if (count) memcpy((void*)ptr, other.ptr, count * sizeof(T));
+        return *this;
+    }
+
+    // keeps the first min(old, n) values, the rest are zeroed
+    void resize(size_t n)
+    {
+        if (n == count) return;
+        T* fresh = nullptr;
+        if (n)
+        {
+            // round up to a whole cache line so SIMD loads past the end stay in bounds
+            size_t bytes = (n * sizeof(T) + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+            fresh = (T*)::operator new(bytes, std::align_val_t(ALIGNMENT));
+            memset((void*)fresh, 0, bytes);
+            if (ptr) memcpy((void*)fresh, ptr, (n < count ? n : count) * sizeof(T));
+        }
+        release();
+        ptr = fresh;
+        count = n;
+    }
+
+    size_t size() const { return count; }
+    T* data() { return ptr; }
+    const T* data() const { return ptr; }
+    T& operator[](size_t i) { return ptr[i]; }
+    const T& operator[](size_t i) const { return ptr[i]; }
+
+private:
+    void release()
+    {
+        if (ptr) ::operator delete(ptr, std::align_val_t(ALIGNMENT));
+        ptr = nullptr;
+    }
+
+    T* ptr = nullptr;
+    size_t count = 0;
+};
+
+// -------- trail history for a whole ensemble --------
+// Every member pushes one point per frame, so a single ring head is shared and
+// the points are stored slot-major: one frame of the ensemble is contiguous.
+class TrailBuffer
+{
+public:
+    static const int MAX_TRAIL = 100;
+
+    struct TrailPoint { float x, y; };
+
+    void reset(int members)
+    {
+        count = members;
+        head = 0;
+        length = 0;
+        points.resize((size_t)members * MAX_TRAIL);
+    }
+
+    // position of the next slot to write, fill it for every member then commit()
+    TrailPoint* slot() { return points.data() + (size_t)head * count; }
+
+    void commit()
+    {
+        head = (head + 1) % MAX_TRAIL;
+        if (length < MAX_TRAIL) length++;
+    }
+
+    void clear() { head = 0; length = 0; }
+
+    // keep members keep[0..n) (increasing) as 0..n, in place
+    void compact(const int* keep, int n)
+    {
+        for (int s = 0; s < MAX_TRAIL; s++)
+            for (int j = 0; j < n; j++)
+                points[(size_t)s * n + j] = points[(size_t)s * count + keep[j]];
+        count = n;
+    }
+
+    int size() const { return length; }
+    int members() const { return count; }
+
+    template <typename A>
+    void serialize(A& ar)
+    {
+        ar.io(count); ar.io(head); ar.io(length);
+        if constexpr (A::reading)
+        {
+            ar.check(count >= 0 && head >= 0 && head < MAX_TRAIL && length >= 0 && length <= MAX_TRAIL
+                && ar.template fits<TrailPoint>((size_t)count * MAX_TRAIL));
+            if (!ar.ok()) count = head = length = 0;
+            points.resize(0);
+            points.resize((size_t)count * MAX_TRAIL);
+        }
+        ar.array(points.data(), (size_t)count * MAX_TRAIL);
+    }
+
+    // k = 0 is the oldest stored point of member i
+    const TrailPoint& at(int i, int k) const
+    {
+        int s = (head - length + k + MAX_TRAIL) % MAX_TRAIL;
+        return points[(size_t)s * count + i];
+    }
+
+    void draw(int i, float r, float g, float b) const
+    {
+        if (length < 2) return;
+
+        glBegin(GL_LINE_STRIP);
+        for (int k = 0; k < length; k++)
+        {
+            float a = (float)k / length;
+            const TrailPoint& p = at(i, k);
+            glColor4f(r, g, b, a);
+            glVertex2f(p.x, p.y);
+        }
+        glEnd();
+    }
+
+private:
+    AlignedArray<TrailPoint> points;
+    int count = 0;
+    int head = 0;
+    int length = 0;
+};
+
+// final state of a member taken out of the ensemble
+template <typename T>
+struct RetiredMember
+{
+    int id;
+    EventKind reason;   // event that retired it, Count for retire()
+    double time;        // ensemble time of the state below
+    T theta1, theta2, omega1, omega2;
+};
+
+// -------- structure-of-arrays pendulum ensemble --------
+// T is the scalar type of the state and of every integrator. Only float runs
+// the SIMD kernels; the wider types step one member at a time.
+template <typename T>
+class PendulumEnsemble
+{
+public:
+    // members per thread pool chunk: the four float state columns of a chunk fill
+    // 32 KB, about one L1 data cache, and it is a multiple of every SIMD width
+    static const int CHUNK = 2048;
+
+    // state columns, one entry per member
+    AlignedArray<T> theta1;
+    AlignedArray<T> theta2;
+    AlignedArray<T> omega1;
+    AlignedArray<T> omega2;
+
+    // Float RK4 keeps the angles in (-pi, pi] and counts the turns it takes
+    // off, so an angle is theta + 2 pi * winding; carry holds the low bits
+    // of the compensated state updates (stepRK4CompensatedBatch). The other
+    // methods and precisions leave the angles unbounded and the carry at 0.
+    AlignedArray<int> winding1;
+    AlignedArray<int> winding2;
+    AlignedArray<T> carry[4];
+
+    // Per-member physical parameters: once setParams() has been called,
+    // member i swings with l1, l2, m1, m2 and gravity from these columns
+    // instead of the frame's SimParams, so a parameter sweep runs as one
+    // ensemble. Float RK4 loads them straight into the SIMD lanes; the other
+    // methods build their constants member by member. Every member's gravity
+    // must have the sign of the frame's, which places the upright position
+    // for the events. resize() turns them off again.
+    bool memberParams = false;
+    AlignedArray<float> paramL1, paramL2, paramM1, paramM2, paramGravity;
+
+    // angles after the second to last step, for render interpolation
+    AlignedArray<T> prevTheta1;
+    AlignedArray<T> prevTheta2;
+
+    // trail color columns
+    AlignedArray<float> colorR;
+    AlignedArray<float> colorG;
+    AlignedArray<float> colorB;
+
+    TrailBuffer trails;
+
+    // per-trajectory Dormand-Prince state, rebuilt whenever the method,
+    // the direction of time or the members change
+    AlignedArray<AdaptiveState<T>> adaptive;
+
+    // simulated time since resize(), advanced by step()
+    double time = 0.0;
+
+    // events found by step() for the eventBit()s in eventMask | retireMask
+    // (RK4 and the symplectic methods; Dormand-Prince and Taylor steps are
+    // not checked).
+    // The caller reads and clears the buffer between steps.
+    static const size_t EVENT_CAPACITY = 1 << 16;
+    int eventMask = 0;
+    AppendBuffer<PendulumEvent> events{ EVENT_CAPACITY };
+
+    // Taylor series steps taken and the member-seconds they covered, for
+    // the mean step size; statistics only, not part of a checkpoint
+    unsigned long long taylorSteps = 0;
+    double taylorTime = 0.0;
+
+    // Poincare section crossings, found like the events and drained by the
+    // caller between steps the same way
+    static const size_t SECTION_CAPACITY = 1 << 18;
+    PoincareSection section;
+    AppendBuffer<SectionPoint> sectionPoints{ SECTION_CAPACITY };
+
+    // Active set: a member whose step produces an event in retireMask (or that
+    // is passed to retire()) is done. Its state at the end of that step goes to
+    // `retired` and compaction later removes it from every column, so SIMD
+    // lanes and threads only see live members. Members keep their original
+    // index in `id`; size() counts the members still in the columns, done ones
+    // waiting for compaction included.
+    static const int COMPACT_FRACTION = 8;  // compact once 1/8 of the live members are done
+    int retireMask = 0;
+    AlignedArray<int> id;
+    AlignedArray<unsigned char> done;
+    AppendBuffer<RetiredMember<T>> retired;
+
+    // energy monitor, see monitorEnergy()
+    static const int DEFAULT_ENERGY_INTERVAL = 50;
+    int energyInterval = 0;
+    float energyThreshold = 1e-3f;
+    EnergyStats energyStats;
+    AlignedArray<T> energy0;                // energy at the baseline
+    AlignedArray<T> energyNorm;             // 1 / max(|energy0|, scale)
+    AlignedArray<float> energyDrift;        // relative drift at the last check
+    AlignedArray<unsigned char> energyFlag; // drift went over the threshold
+
+    // Lyapunov spectrum and MEGNO (Lyapunov.h): with lyapunovInterval > 0
+    // the selected method steps every member on dual numbers, carrying four
+    // tangent vectors that are orthonormalised every lyapunovInterval steps;
+    // the state follows the same trajectory as without them. Dormand-Prince
+    // and Taylor steps leave the tangents alone (lyapunov::supports()).
+    // resetLyapunov() restarts the estimates.
+    static const int DEFAULT_LYAPUNOV_INTERVAL = 10;
+    int lyapunovInterval = 0;
+    double lyapunovTime = 0.0;                          // time integrated since the reset
+    AlignedArray<T> tangent[lyapunov::DIM * lyapunov::DIM]; // component c of vector j at 4 * j + c
+    AlignedArray<double> lyapunovSum[lyapunov::DIM];    // sum of log growth of each vector
+    AlignedArray<double> megnoWeighted;                 // sum of interval midpoint * log growth of v0
+    AlignedArray<double> megnoIntegral;                 // integral of Y(t)
+
+    // run the float kernels one lane at a time (simd::vfloat1) instead of
+    // simd::vfloat; in a SIMD_DETERMINISTIC build both give the same bits
+    bool scalarKernels = false;
+
+    // Pendulum-like handle on one member, valid until the ensemble is resized
+    struct View
+    {
+        PendulumEnsemble& owner;
+        int index;
+        T& theta1;
+        T& theta2;
+        T& omega1;
+        T& omega2;
+
+        void updateMotionRK4(T dt, SimParams params)
+        {
+            stepRK4<T>(theta1, theta2, omega1, omega2, dt, BasicPendulumConsts<T>(owner.paramsOf(params, index)));
+        }
+
+        void draw(float cx, float cy, SimParams params) { owner.draw(index, cx, cy, params); }
+    };
+
+    int size() const { return count; }
+
+    void resize(int n)
+    {
+        count = n;
+        id.resize(n); done.resize(n);
+        for (int i = 0; i < n; i++) { id[i] = i; done[i] = 0; }
+        retired.reserve(n);
+        compactedRetired = 0;
+        energy0.resize(n); energyNorm.resize(n); energyDrift.resize(n); energyFlag.resize(n);
+        energyBaseline = false;
+        energyStats = EnergyStats();
+        stepsSinceEnergy = 0;
+        theta1.resize(n); theta2.resize(n);
+        omega1.resize(n); omega2.resize(n);
+        winding1.resize(n); winding2.resize(n);
+        memset((void*)winding1.data(), 0, n * sizeof(int));
+        memset((void*)winding2.data(), 0, n * sizeof(int));
+        for (AlignedArray<T>& column : carry) column.resize(n);
+        dropCarry();
+        prevTheta1.resize(n); prevTheta2.resize(n);
+        colorR.resize(n); colorG.resize(n); colorB.resize(n);
+        memberParams = false;
+        paramL1.resize(n); paramL2.resize(n);
+        paramM1.resize(n); paramM2.resize(n); paramGravity.resize(n);
+        adaptive.resize(n);
+        adaptiveDirection = 0.0f;
+        for (AlignedArray<T>& column : tangent) column.resize(n);
+        for (AlignedArray<double>& column : lyapunovSum) column.resize(n);
+        megnoWeighted.resize(n); megnoIntegral.resize(n);
+        resetLyapunov();
+        trails.reset(n);
+        time = 0.0;
+        events.clear();
+        sectionPoints.clear();
+        taylorSteps = 0;
+        taylorTime = 0.0;
+    }
+
+    // same seeding as Pendulum(initial_theta1, initial_theta2, hue)
+    void set(int i, T initial_theta1, T initial_theta2, float hue)
+    {
+        const T y[4] = { initial_theta1, initial_theta2, T(0), T(0) };
+        setState(i, y, hue);
+        adaptiveDirection = 0.0f;
+    }
+
+    // set every member from f(i, y, hue) (y = theta1, theta2, omega1,
+    // omega2), chunks in parallel; f must depend on i alone
+    template <typename F>
+    void setAll(ThreadPool& pool, F&& f)
+    {
+        pool.parallelFor(count, CHUNK, [&](int begin, int end) {
+            for (int i = begin; i < end; i++)
+            {
+                T y[4];
+                float hue;
+                f(i, y, hue);
+                setState(i, y, hue);
+            }
+            });
+        adaptiveDirection = 0.0f;
+    }
+
+    // give member i its own physical parameters (rtol and atol stay the
+    // frame's); the other members keep theirs, which are the defaults of
+    // SimParams until set
+    void setParams(int i, const SimParams& p)
+    {
+        if (!memberParams)
+        {
+            const SimParams defaults;
+            for (int j = 0; j < count; j++) storeParams(j, defaults);
+            memberParams = true;
+        }
+        storeParams(i, p);
+        energyBaseline = false;
+        adaptiveDirection = 0.0f;
+    }
+
+    // the parameters member i steps with in a frame whose snapshot is `frame`
+    SimParams paramsOf(const SimParams& frame, int i) const
+    {
+        if (!memberParams) return frame;
+        SimParams p = frame;
+        p.l1 = paramL1[i]; p.l2 = paramL2[i];
+        p.m1 = paramM1[i]; p.m2 = paramM2[i];
+        p.gravity = paramGravity[i];
+        return p;
+    }
+
+    View operator[](int i)
+    {
+        return View{ *this, i, theta1[i], theta2[i], omega1[i], omega2[i] };
+    }
+
+    // advance every member by `steps` steps of size dt, then run the energy
+    // monitor when it is due and compact the active set when enough are done.
+    // `params` is this frame's snapshot; the workers only see this copy.
+    // Nothing here depends on the thread count: chunks are cut at fixed
+    // CHUNK boundaries, reductions combine them in chunk order and the events
+    // and retirements the workers push are sorted afterwards. A frame that
+    // overflows the event or section buffer keeps none of its items there.
+    void step(SimParams params, T dt, int steps, Integrator method, ThreadPool& pool)
+    {
+        // the energy baseline is the state before the first step
+        if (energyInterval > 0 && !energyBaseline)
+            checkEnergy(params, pool);
+
+        const size_t eventsBefore = events.size(), retiredBefore = retired.size();
+        const size_t pointsBefore = sectionPoints.size();
+        stepMembers(params, dt, steps, method, pool);
+        events.dropOverflowFrom(eventsBefore);
+        sectionPoints.dropOverflowFrom(pointsBefore);
+        events.sortFrom(eventsBefore, [](const PendulumEvent& a, const PendulumEvent& b) {
+            if (a.time != b.time) return a.time < b.time;
+            if (a.member != b.member) return a.member < b.member;
+            return a.kind < b.kind;
+            });
+        sectionPoints.sortFrom(pointsBefore, [](const SectionPoint& a, const SectionPoint& b) {
+            return a.time != b.time ? a.time < b.time : a.member < b.member;
+            });
+        retired.sortFrom(retiredBefore, [](const RetiredMember<T>& a, const RetiredMember<T>& b) {
+            return a.time != b.time ? a.time < b.time : a.id < b.id;
+            });
+        time += (double)dt * steps;
+        monitorEnergy(params, steps, pool);
+        compactIfNeeded();
+    }
+
+    // The stepping itself, spreading chunks of CHUNK members over the pool. RK4
+    // runs simd::vfloat::width members at a time, with a compile-time
+    // specialized kernel when params match a preset (or the members' own
+    // parameters in the lanes); the symplectic methods convert to canonical
+    // momenta for the frame. Enabled events are checked after every step.
+    void stepMembers(SimParams params, T dt, int steps, Integrator method, ThreadPool& pool)
+    {
+        const EventDetector detector(eventMask | retireMask, params.gravity, section, &sectionPoints);
+        if (memberParams)
+            padParams();
+
+        // only float RK4 adds with compensation; a carry left from it would
+        // be wrong for the state another method produces
+        if (!std::is_same<T, float>::value || method != Integrator::RK4)
+            dropCarry();
+
+        if (lyapunovInterval > 0 && lyapunov::supports(method))
+        {
+            stepLyapunov(params, dt, steps, method, pool, detector);
+            return;
+        }
+
+        if (method == Integrator::DormandPrince45)
+        {
+            stepAdaptive(params, dt, steps, pool);
+            return;
+        }
+        if (method == Integrator::Taylor)
+        {
+            stepTaylor(params, dt, steps, pool);
+            return;
+        }
+        adaptiveDirection = 0.0f;
+
+        if (!isSymplectic(method))
+        {
+            Presets::withConsts<T>(params, [&](const auto& k) {
+                pool.parallelFor(count, CHUNK, [&](int begin, int end) {
+                    if constexpr (std::is_same<T, float>::value)
+                    {
+                        if (scalarKernels)
+                            stepFloatRK4<simd::vfloat1>(begin, end, dt, steps, k, params, detector);
+                        else
+                            stepFloatRK4<simd::vfloat>(begin, end, dt, steps, k, params, detector);
+                    }
+                    else
+                    {
+                        auto stepOne = [&](int i, const auto& km) {
+                            for (int s = 0; s < steps && !done[i]; s++)
+                            {
+                                const T y0[4] = { theta1[i], theta2[i], omega1[i], omega2[i] };
+                                stepRK4<T>(theta1[i], theta2[i], omega1[i], omega2[i], dt, km);
+                                if (!detector.active()) continue;
+                                const T y1[4] = { theta1[i], theta2[i], omega1[i], omega2[i] };
+                                int found = detector.refine(id[i], time + (double)dt * s, (double)dt, y0, y1, km, events);
+                                if (found & retireMask)
+                                    retireAfterEvent(i, found, time + (double)dt * (s + 1), y1);
+                            }
+                            };
+                        for (int i = begin; i < end; i++)
+                            if (memberParams)
+                                stepOne(i, BasicPendulumConsts<T>(paramsOf(params, i)));
+                            else
+                                stepOne(i, k);
+                    }
+                    });
+                });
+            return;
+        }
+
+        pool.parallelFor(count, CHUNK, [&](int begin, int end) {
+            for (int i = begin; i < end; i++)
+            {
+                if (done[i]) continue;
+                const SimParams p = paramsOf(params, i);
+                const DoublePendulumHamiltonian<T> H{ T(p.l1), T(p.l2), T(p.m1), T(p.m2), T(p.gravity) };
+                const BasicPendulumConsts<T> k(p);
+                T th1 = theta1[i], th2 = theta2[i], p1, p2;
+                T w1 = omega1[i], w2 = omega2[i];
+                H.momenta(th1, th2, w1, w2, p1, p2);
+                for (int s = 0; s < steps; s++)
+                {
+                    const T y0[4] = { th1, th2, w1, w2 };
+                    H.step(method, th1, th2, p1, p2, dt);
+                    if (!detector.active()) continue;
+                    // the events need the angular velocities after every step
+                    H.velocities(th1, th2, p1, p2, w1, w2);
+                    const T y1[4] = { th1, th2, w1, w2 };
+                    int found = detector.refine(id[i], time + (double)dt * s, (double)dt, y0, y1, k, events);
+                    if (found & retireMask)
+                    {
+                        retireAfterEvent(i, found, time + (double)dt * (s + 1), y1);
+                        break;
+                    }
+                }
+                theta1[i] = th1;
+                theta2[i] = th2;
+                H.velocities(th1, th2, p1, p2, omega1[i], omega2[i]);
+            }
+            });
+    }
+
+    // Energy monitor: every energyInterval steps (0 = off) the total energy of
+    // every live member is compared with its energy at the baseline check,
+    // taken after resize() or when the physical parameters change. Members
+    // whose relative drift exceeds energyThreshold are flagged for good.
+    // Done members waiting for compaction are left out of the statistics.
+    void monitorEnergy(const SimParams& params, int steps, ThreadPool& pool)
+    {
+        if (energyInterval <= 0) return;
+        stepsSinceEnergy += steps;
+        if (stepsSinceEnergy < energyInterval) return;
+        stepsSinceEnergy = 0;
+        checkEnergy(params, pool);
+    }
+
+    void checkEnergy(const SimParams& params, ThreadPool& pool)
+    {
+        if (count == 0) return;
+        const bool rebase = !energyBaseline || (!memberParams && !samePhysics(params, energyParams));
+        energyBaseline = true;
+        energyParams = params;
+
+        const EnergyConsts<T> k(params);
+        const int chunks = (count + CHUNK - 1) / CHUNK;
+        std::vector<EnergyStats> partial(chunks);
+        std::vector<int> live(chunks);
+        const float threshold = energyThreshold;
+
+        pool.parallelFor(count, CHUNK, [&](int begin, int end) {
+            // with shared constants the float energies come in batches
+            if constexpr (std::is_same<T, float>::value)
+            {
+                if (!memberParams && scalarKernels)
+                    energyBatch<simd::vfloat1>(theta1.data() + begin, theta2.data() + begin,
+                        omega1.data() + begin, omega2.data() + begin, energyDrift.data() + begin, end - begin, k);
+                else if (!memberParams)
+                    energyBatch<simd::vfloat>(theta1.data() + begin, theta2.data() + begin,
+                        omega1.data() + begin, omega2.data() + begin, energyDrift.data() + begin, end - begin, k);
+            }
+
+            EnergyStats& st = partial[begin / CHUNK];
+            float lo = 0.0f, hi = 0.0f, worst = 0.0f, sum = 0.0f;
+            int flagged = 0, n = 0;
+            for (int i = begin; i < end; i++)
+            {
+                if (done[i]) continue;
+                T e, scale = k.scale;
+                if (memberParams)
+                {
+                    const EnergyConsts<T> own(paramsOf(params, i));
+                    e = pendulumEnergy(theta1[i], theta2[i], omega1[i], omega2[i], own);
+                    scale = own.scale;
+                }
+                else if constexpr (std::is_same<T, float>::value)
+                    e = energyDrift[i];
+                else
+                    e = pendulumEnergy(theta1[i], theta2[i], omega1[i], omega2[i], k);
+                if (rebase)
+                {
+                    T ref = e < T(0) ? -e : e;
+                    if (ref < scale) ref = scale;
+                    energy0[i] = e;
+                    energyNorm[i] = T(1) / ref;
+                    energyFlag[i] = 0;
+                }
+                float d = (float)((e - energy0[i]) * energyNorm[i]);
+                energyDrift[i] = d;
+
+                float ad = fabsf(d);
+                if (ad > threshold) energyFlag[i] = 1;
+                flagged += energyFlag[i];
+                lo = n == 0 || d < lo ? d : lo;
+                hi = n == 0 || d > hi ? d : hi;
+                worst = ad > worst ? ad : worst;
+                sum += d;
+                n++;
+            }
+            st.minDrift = lo; st.maxDrift = hi;
+            st.worstDrift = worst;
+            st.meanDrift = sum;
+            st.flagged = flagged;
+            live[begin / CHUNK] = n;
+            });
+
+        EnergyStats total;
+        double sum = 0.0;
+        int members = 0;
+        for (int c = 0; c < chunks; c++)
+        {
+            const EnergyStats& st = partial[c];
+            if (live[c] == 0) continue;
+            total.minDrift = members == 0 || st.minDrift < total.minDrift ? st.minDrift : total.minDrift;
+            total.maxDrift = members == 0 || st.maxDrift > total.maxDrift ? st.maxDrift : total.maxDrift;
+            total.worstDrift = st.worstDrift > total.worstDrift ? st.worstDrift : total.worstDrift;
+            total.flagged += st.flagged;
+            sum += st.meanDrift;
+            members += live[c];
+        }
+        total.meanDrift = members ? (float)(sum / members) : 0.0f;
+        if (!rebase && energyStats.worstDrift > total.worstDrift) total.worstDrift = energyStats.worstDrift;
+        total.time = time;
+        energyStats = total;
+    }
+
+    // take member i out now, for criteria decided outside step()
+    void retire(int i)
+    {
+        if (done[i]) return;
+        done[i] = 1;
+        retired.push({ id[i], EventKind::Count, time, theta1[i], theta2[i], omega1[i], omega2[i] });
+    }
+
+    // drop the done members from every column, keeping the order of the others
+    void compact()
+    {
+        std::vector<int> keep;
+        keep.reserve(count);
+        for (int i = 0; i < count; i++)
+            if (!done[i]) keep.push_back(i);
+        compactedRetired = retired.size();
+        const int n = (int)keep.size();
+        if (n == count) return;
+
+        auto gather = [&](auto& column) {
+            for (int j = 0; j < n; j++) column[j] = column[keep[j]];
+            };
+        gather(theta1); gather(theta2);
+        gather(omega1); gather(omega2);
+        gather(winding1); gather(winding2);
+        for (AlignedArray<T>& column : carry) gather(column);
+        gather(prevTheta1); gather(prevTheta2);
+        gather(colorR); gather(colorG); gather(colorB);
+        if (memberParams)
+        {
+            gather(paramL1); gather(paramL2);
+            gather(paramM1); gather(paramM2); gather(paramGravity);
+        }
+        gather(adaptive);
+        gather(id);
+        gather(energy0); gather(energyNorm); gather(energyDrift); gather(energyFlag);
+        for (AlignedArray<T>& column : tangent) gather(column);
+        for (AlignedArray<double>& column : lyapunovSum) gather(column);
+        gather(megnoWeighted); gather(megnoIntegral);
+        for (int j = 0; j < n; j++) done[j] = 0;
+        trails.compact(keep.data(), n);
+        count = n;
+    }
+
+    // identity tangents, zero sums
+    void resetLyapunov()
+    {
+        for (int j = 0; j < lyapunov::DIM; j++)
+            for (int c = 0; c < lyapunov::DIM; c++)
+                for (int i = 0; i < count; i++)
+                    tangent[lyapunov::DIM * j + c][i] = T(j == c ? 1 : 0);
+        for (AlignedArray<double>& column : lyapunovSum)
+            memset((void*)column.data(), 0, count * sizeof(double));
+        memset((void*)megnoWeighted.data(), 0, count * sizeof(double));
+        memset((void*)megnoIntegral.data(), 0, count * sizeof(double));
+        lyapunovTime = 0.0;
+        lastOrthoTime = 0.0;
+        stepsSinceOrtho = 0;
+    }
+
+    // the steps of stepMembers() on duals carrying the tangents, with
+    // Gram-Schmidt after the steps lyapunov::Schedule picks. Every member
+    // runs all `steps` in one go, so the symplectic methods convert to
+    // momenta once per call as without tangents.
+    void stepLyapunov(const SimParams& params, T dt, int steps, Integrator method, ThreadPool& pool,
+        const EventDetector& detector)
+    {
+        adaptiveDirection = 0.0f;
+        const lyapunov::Schedule schedule(lyapunovInterval, stepsSinceOrtho, lyapunovTime, fabs((double)dt), lastOrthoTime);
+
+        if (!isSymplectic(method))
+        {
+            Presets::withConsts<T>(params, [&](const auto& k) {
+                pool.parallelFor(count, CHUNK, [&](int begin, int end) {
+                    if constexpr (std::is_same<T, float>::value)
+                    {
+                        if (scalarKernels)
+                            stepFloatTangents<simd::vfloat1>(begin, end, dt, steps, k, params, detector, schedule);
+                        else
+                            stepFloatTangents<simd::vfloat>(begin, end, dt, steps, k, params, detector, schedule);
+                    }
+                    else
+                    {
+                        for (int i = begin; i < end; i++)
+                        {
+                            if (done[i]) continue;
+                            if (memberParams)
+                                stepTangentsRK4(i, dt, steps, BasicPendulumConsts<T>(paramsOf(params, i)), detector, schedule);
+                            else
+                                stepTangentsRK4(i, dt, steps, k, detector, schedule);
+                        }
+                    }
+                    });
+                });
+        }
+        else
+        {
+            pool.parallelFor(count, CHUNK, [&](int begin, int end) {
+                for (int i = begin; i < end; i++)
+                    if (!done[i])
+                        stepTangentsSymplectic(i, params, dt, steps, method, detector, schedule);
+                });
+        }
+
+        schedule.finish(steps, stepsSinceOrtho, lastOrthoTime);
+        lyapunovTime = schedule.at(steps);
+    }
+
+    ChaosStats chaosStats() const
+    {
+        ChaosStats st;
+        st.time = lyapunovTime;
+        if (lyapunovTime <= 0.0) return st;
+        for (int i = 0; i < count; i++)
+        {
+            if (done[i]) continue;
+            for (int j = 0; j < lyapunov::DIM; j++)
+                st.spectrum[j] += lyapunovSum[j][i];
+            double lambda0 = lyapunovSum[0][i] / lyapunovTime;
+            if (st.members == 0 || lambda0 > st.maxExponent) st.maxExponent = lambda0;
+            double megno = megnoIntegral[i] / lyapunovTime;
+            st.megno += megno;
+            if (megno > lyapunov::MEGNO_CHAOTIC) st.chaotic++;
+            st.members++;
+        }
+        if (st.members == 0) return st;
+        for (double& lambda : st.spectrum) lambda /= st.members * lyapunovTime;
+        st.megno /= st.members;
+        return st;
+    }
+
+    // Everything step() depends on, so a restored ensemble continues bit for
+    // bit: the columns, time, Dormand-Prince state, the active set and the
+    // energy monitor. Pending events are not kept, the caller drains them
+    // every frame anyway.
+    template <typename A>
+    void serialize(A& ar)
+    {
+        uint32_t scalarSize = sizeof(T);
+        int n = count;
+        ar.io(scalarSize);
+        ar.io(n);
+        if constexpr (A::reading)
+        {
+            ar.check(scalarSize == sizeof(T) && n >= 0 && ar.template fits<T>((size_t)n * 6));
+            resize(ar.ok() ? n : 0);
+        }
+        ar.io(time);
+        ar.array(theta1.data(), count); ar.array(theta2.data(), count);
+        ar.array(omega1.data(), count); ar.array(omega2.data(), count);
+        ar.array(prevTheta1.data(), count); ar.array(prevTheta2.data(), count);
+        ar.array(colorR.data(), count); ar.array(colorG.data(), count); ar.array(colorB.data(), count);
+        ar.array(adaptive.data(), count);
+        ar.io(adaptiveDirection);
+        ar.array(id.data(), count); ar.array(done.data(), count);
+        ar.io(eventMask); ar.io(retireMask);
+        retired.serialize(ar);
+        ar.io(compactedRetired);
+        ar.io(energyInterval); ar.io(energyThreshold);
+        energyStats.serialize(ar);
+        ar.array(energy0.data(), count); ar.array(energyNorm.data(), count);
+        ar.array(energyDrift.data(), count); ar.array(energyFlag.data(), count);
+        ar.io(energyBaseline); ar.io(energyParams); ar.io(stepsSinceEnergy);
+        trails.serialize(ar);
+        if constexpr (A::reading)
+            ar.check(trails.members() == count && compactedRetired <= retired.size());
+
+        if (ar.version >= 2)
+        {
+            ar.io(lyapunovInterval); ar.io(lyapunovTime);
+            ar.io(lastOrthoTime); ar.io(stepsSinceOrtho);
+            for (AlignedArray<T>& column : tangent) ar.array(column.data(), count);
+            for (AlignedArray<double>& column : lyapunovSum) ar.array(column.data(), count);
+            ar.array(megnoWeighted.data(), count);
+            ar.array(megnoIntegral.data(), count);
+        }
+        if (ar.version >= 4)
+        {
+            ar.array(winding1.data(), count); ar.array(winding2.data(), count);
+            for (AlignedArray<T>& column : carry) ar.array(column.data(), count);
+        }
+        if (ar.version >= 5)
+        {
+            ar.io(memberParams);
+            if (memberParams)
+            {
+                ar.array(paramL1.data(), count); ar.array(paramL2.data(), count);
+                ar.array(paramM1.data(), count); ar.array(paramM2.data(), count);
+                ar.array(paramGravity.data(), count);
+            }
+        }
+        if (ar.version >= 7)
+            ar.io(adaptiveParams);
+        else if constexpr (A::reading)
+            adaptiveDirection = 0.0f;   // unknown model, restart Dormand-Prince
+    }
+
+    // Dormand-Prince: each member takes as many steps as its error control needs
+    // to cover dt * steps, the columns receive its dense output at that time
+    void stepAdaptive(SimParams params, T dt, int steps, ThreadPool& pool)
+    {
+        DormandPrince45<T> solver{ BasicPendulumConsts<T>(params), params.rtol, params.atol };
+
+        const float direction = dt < T(0) ? -1.0f : 1.0f;
+        // the stored first stage is a derivative of the old model, so a new
+        // one (setParams restarts by itself) starts every member over too
+        const bool restart = direction != adaptiveDirection
+            || (!memberParams && !samePhysics(params, adaptiveParams));
+        adaptiveDirection = direction;
+        adaptiveParams = params;
+
+        pool.parallelFor(count, CHUNK, [&](int begin, int end) {
+            for (int i = begin; i < end; i++)
+            {
+                if (done[i]) continue;
+                T y[4] = { theta1[i], theta2[i], omega1[i], omega2[i] };
+                const DormandPrince45<T> own = memberParams
+                    ? DormandPrince45<T>{ BasicPendulumConsts<T>(paramsOf(params, i)), params.rtol, params.atol } : solver;
+                if (restart)
+                    own.start(adaptive[i], y, dt);
+                own.advance(adaptive[i], dt * T(steps), y);
+                theta1[i] = y[0]; theta2[i] = y[1];
+                omega1[i] = y[2]; omega2[i] = y[3];
+            }
+            });
+    }
+
+    // Taylor series: every member takes as many steps of its own order and
+    // size as the tolerances allow, the last one cut to end at dt * steps, so
+    // nothing carries over between calls
+    void stepTaylor(SimParams params, T dt, int steps, ThreadPool& pool)
+    {
+        adaptiveDirection = 0.0f;
+        const BasicPendulumConsts<T> k(params);
+        std::atomic<unsigned long long> taken{ 0 };
+        std::atomic<int> live{ 0 };
+
+        pool.parallelFor(count, CHUNK, [&](int begin, int end) {
+            TaylorSeries<T> solver(k, params.rtol, params.atol);
+            unsigned long long chunkSteps = 0;
+            int chunkLive = 0;
+            for (int i = begin; i < end; i++)
+            {
+                if (done[i]) continue;
+                T y[4] = { theta1[i], theta2[i], omega1[i], omega2[i] };
+                if (memberParams)
+                    solver.k = BasicPendulumConsts<T>(paramsOf(params, i));
+                chunkSteps += solver.advance(y, dt * T(steps));
+                chunkLive++;
+                theta1[i] = y[0]; theta2[i] = y[1];
+                omega1[i] = y[2]; omega2[i] = y[3];
+            }
+            taken += chunkSteps;
+            live += chunkLive;
+            });
+        taylorSteps += taken;
+        taylorTime += fabs((double)dt) * steps * live;
+    }
+
+    // remember the current angles as the start of the next render interpolation
+    void storePrevious()
+    {
+        memcpy((void*)prevTheta1.data(), theta1.data(), count * sizeof(T));
+        memcpy((void*)prevTheta2.data(), theta2.data(), count * sizeof(T));
+    }
+
+    // angles to draw, `alpha` of the way from the previous to the current step
+    // (the short way round when the last step wrapped an angle)
+    void renderAngles(int i, float alpha, float& a1, float& a2) const
+    {
+        const double TWO_PI = 6.283185307179586;
+        double d1 = (double)(theta1[i] - prevTheta1[i]), d2 = (double)(theta2[i] - prevTheta2[i]);
+        d1 -= TWO_PI * floor(d1 / TWO_PI + 0.5);
+        d2 -= TWO_PI * floor(d2 / TWO_PI + 0.5);
+        a1 = (float)((double)prevTheta1[i] + alpha * d1);
+        a2 = (float)((double)prevTheta2[i] + alpha * d2);
+    }
+
+    // append the interpolated bob-2 positions to the trails
+    void updateTrails(float cx, float cy, float alpha, const SimParams& params)
+    {
+        TrailBuffer::TrailPoint* out = trails.slot();
+        for (int i = 0; i < count; i++)
+        {
+            float a1, a2;
+            renderAngles(i, alpha, a1, a2);
+            const float l1 = memberParams ? paramL1[i] : params.l1, l2 = memberParams ? paramL2[i] : params.l2;
+            out[i].x = cx + l1 * sinf(a1) + l2 * sinf(a2);
+            out[i].y = cy - l1 * cosf(a1) - l2 * cosf(a2);
+        }
+        trails.commit();
+    }
+
+    void draw(int i, float cx, float cy, const SimParams& params, float alpha = 1.0f) const
+    {
+        if (g_showTrails)
+            trails.draw(i, colorR[i], colorG[i], colorB[i]);
+        if (!g_showPendulums) return;
+
+        float a1, a2;
+        renderAngles(i, alpha, a1, a2);
+        const float l1 = memberParams ? paramL1[i] : params.l1, l2 = memberParams ? paramL2[i] : params.l2;
+        float x2 = cx + l1 * sinf(a1);
+        float y2 = cy - l1 * cosf(a1);
+        float x3 = x2 + l2 * sinf(a2);
+        float y3 = y2 - l2 * cosf(a2);
+
+        glColor3f(1, 1, 1);
+        glBegin(GL_LINES);
+        glVertex2f(cx, cy); glVertex2f(x2, y2);
+        glVertex2f(x2, y2); glVertex2f(x3, y3);
+        glEnd();
+
+        glPointSize(6);
+        glBegin(GL_POINTS);
+        glVertex2f(x2, y2);
+        glVertex2f(x3, y3);
+        glEnd();
+    }
+
+    void draw(float cx, float cy, float alpha, const SimParams& params) const
+    {
+        for (int i = 0; i < count; i++)
+            draw(i, cx, cy, params, alpha);
+    }
+
+private:
+    // touches member i's columns only, so members can be set concurrently
+    void setState(int i, const T* y, float hue)
+    {
+        theta1[i] = y[0];
+        theta2[i] = y[1];
+        omega1[i] = y[2];
+        omega2[i] = y[3];
+        winding1[i] = winding2[i] = 0;
+        for (AlignedArray<T>& column : carry) column[i] = T(0);
+        prevTheta1[i] = y[0];
+        prevTheta2[i] = y[1];
+        // the colours are checkpointed, so they take the pinned sin too
+        colorR[i] = fabsf(simd::scalarSin(hue));
+        colorG[i] = fabsf(simd::scalarSin(hue + 2.1f));
+        colorB[i] = fabsf(simd::scalarSin(hue + 4.2f));
+    }
+
+    // float RK4 on members [begin, end), V::width at a time, compensated and
+    // with wrapped angles, with the events of `detector` located in the lanes
+    // that have a candidate
+    template <typename V, typename K>
+    void stepFloatRK4(int begin, int end, float dt, int steps, const K& k, const SimParams& params,
+        const EventDetector& detector)
+    {
+        forBatches<V>(begin, end, k, [&](int first, int n, const auto& kb) {
+            float* th1 = theta1.data() + first;
+            float* th2 = theta2.data() + first;
+            float* w1 = omega1.data() + first;
+            float* w2 = omega2.data() + first;
+            float* const c[4] = { carry[0].data() + first, carry[1].data() + first, carry[2].data() + first, carry[3].data() + first };
+            int* n1 = winding1.data() + first;
+            int* n2 = winding2.data() + first;
+            if (!detector.active())
+                stepRK4CompensatedBatch<V>(th1, th2, w1, w2, c, n1, n2, n, dt, steps, kb);
+            else
+                stepRK4CompensatedBatch<V>(th1, th2, w1, w2, c, n1, n2, n, dt, steps, kb,
+                    eventObserver<V>(first, time, dt, k, params, detector));
+            });
+    }
+
+    // the Lyapunov mode's compensated RK4 on duals for float members
+    // [begin, end); the lanes go through Gram-Schmidt one member at a time
+    template <typename V, typename K>
+    void stepFloatTangents(int begin, int end, float dt, int steps, const K& k, const SimParams& params,
+        const EventDetector& detector, const lyapunov::Schedule& schedule)
+    {
+        const int D = lyapunov::DIM;
+        forBatches<V>(begin, end, k, [&](int first, int n, const auto& kb) {
+            float* state[D] = { theta1.data() + first, theta2.data() + first,
+                omega1.data() + first, omega2.data() + first };
+            float* const c[D] = { carry[0].data() + first, carry[1].data() + first, carry[2].data() + first, carry[3].data() + first };
+            float* tangents[D * D];
+            for (int j = 0; j < D * D; j++) tangents[j] = tangent[j].data() + first;
+            auto renormalize = [&](int i, int s, Dual<V, lyapunov::DIM>* x) {
+                if (!schedule.due(s + 1)) return;
+                alignas(64) float lanes[D][D][V::width];
+                for (int j = 0; j < D; j++)
+                    for (int cc = 0; cc < D; cc++) x[cc].d[j].store(lanes[j][cc]);
+                for (int l = 0; l < V::width; l++)
+                {
+                    const int member = first + i + l;
+                    if (member >= count || done[member]) continue;
+                    double v[D][D];
+                    for (int j = 0; j < D; j++)
+                        for (int cc = 0; cc < D; cc++) v[j][cc] = lanes[j][cc][l];
+                    if (!accumulateGrowth(member, v, s + 1, schedule)) continue;
+                    for (int j = 0; j < D; j++)
+                        for (int cc = 0; cc < D; cc++) lanes[j][cc][l] = (float)v[j][cc];
+                }
+                for (int j = 0; j < D; j++)
+                    for (int cc = 0; cc < D; cc++) x[cc].d[j] = V::load(lanes[j][cc]);
+                };
+            lyapunov::stepTangentCompensatedBatch<V>(state, tangents, c, winding1.data() + first, winding2.data() + first,
+                n, dt, steps, kb, eventObserver<V>(first, time, dt, k, params, detector), renormalize);
+            });
+    }
+
+    // RK4 on duals for member i, as stepMembers() steps it without tangents
+    template <typename K>
+    void stepTangentsRK4(int i, T dt, int steps, const K& k, const EventDetector& detector,
+        const lyapunov::Schedule& schedule)
+    {
+        typedef Dual<T, lyapunov::DIM> D;
+        D x[lyapunov::DIM] = { theta1[i], theta2[i], omega1[i], omega2[i] };
+        loadTangents(i, x);
+        for (int s = 0; s < steps; s++)
+        {
+            const T y0[4] = { x[0].v, x[1].v, x[2].v, x[3].v };
+            stepRK4<D>(x[0], x[1], x[2], x[3], D(dt), k);
+            if (detector.active())
+            {
+                const T y1[4] = { x[0].v, x[1].v, x[2].v, x[3].v };
+                int found = detector.refine(id[i], time + (double)dt * s, (double)dt, y0, y1, k, events);
+                if (found & retireMask)
+                {
+                    retireAfterEvent(i, found, time + (double)dt * (s + 1), y1);
+                    break;
+                }
+            }
+            if (schedule.due(s + 1))
+                renormalize(i, x, s + 1, schedule);
+        }
+        theta1[i] = x[0].v; theta2[i] = x[1].v;
+        omega1[i] = x[2].v; omega2[i] = x[3].v;
+        storeTangents(i, x);
+    }
+
+    // a symplectic method on duals for member i. The tangents live in
+    // (theta, omega) between calls and in (theta, p) during one: Gram-Schmidt
+    // maps them to (theta, omega) and back, leaving the values untouched.
+    void stepTangentsSymplectic(int i, const SimParams& params, T dt, int steps, Integrator method,
+        const EventDetector& detector, const lyapunov::Schedule& schedule)
+    {
+        typedef Dual<T, lyapunov::DIM> D;
+        const SimParams p = paramsOf(params, i);
+        const DoublePendulumHamiltonian<T> H{ T(p.l1), T(p.l2), T(p.m1), T(p.m2), T(p.gravity) };
+        const DoublePendulumHamiltonian<D> HD{ D(T(p.l1)), D(T(p.l2)), D(T(p.m1)), D(T(p.m2)), D(T(p.gravity)) };
+        const BasicPendulumConsts<T> k(p);
+        D x[lyapunov::DIM] = { theta1[i], theta2[i], omega1[i], omega2[i] };
+        loadTangents(i, x);
+        D p1, p2;
+        HD.momenta(x[0], x[1], x[2], x[3], p1, p2);
+        T w1 = x[2].v, w2 = x[3].v;
+        for (int s = 0; s < steps; s++)
+        {
+            const T y0[4] = { x[0].v, x[1].v, w1, w2 };
+            HD.step(method, x[0], x[1], p1, p2, D(dt));
+            if (detector.active())
+            {
+                // the events need the angular velocities after every step
+                H.velocities(x[0].v, x[1].v, p1.v, p2.v, w1, w2);
+                const T y1[4] = { x[0].v, x[1].v, w1, w2 };
+                int found = detector.refine(id[i], time + (double)dt * s, (double)dt, y0, y1, k, events);
+                if (found & retireMask)
+                {
+                    retireAfterEvent(i, found, time + (double)dt * (s + 1), y1);
+                    break;
+                }
+            }
+            if (schedule.due(s + 1))
+            {
+                HD.velocities(x[0], x[1], p1, p2, x[2], x[3]);
+                if (renormalize(i, x, s + 1, schedule))
+                {
+                    D q1, q2;
+                    HD.momenta(x[0], x[1], x[2], x[3], q1, q2);
+                    for (int j = 0; j < lyapunov::DIM; j++)
+                    {
+                        p1.d[j] = q1.d[j];
+                        p2.d[j] = q2.d[j];
+                    }
+                }
+            }
+        }
+        HD.velocities(x[0], x[1], p1, p2, x[2], x[3]);
+        theta1[i] = x[0].v; theta2[i] = x[1].v;
+        omega1[i] = x[2].v; omega2[i] = x[3].v;
+        storeTangents(i, x);
+    }
+
+    // x[c].d[j] = component c of tangent j of member i, and back
+    template <typename D>
+    void loadTangents(int i, D* x) const
+    {
+        for (int j = 0; j < lyapunov::DIM; j++)
+            for (int c = 0; c < lyapunov::DIM; c++) x[c].d[j] = tangent[lyapunov::DIM * j + c][i];
+    }
+
+    template <typename D>
+    void storeTangents(int i, const D* x)
+    {
+        for (int j = 0; j < lyapunov::DIM; j++)
+            for (int c = 0; c < lyapunov::DIM; c++) tangent[lyapunov::DIM * j + c][i] = x[c].d[j];
+    }
+
+    // Gram-Schmidt on the derivative parts of x, due after step c
+    template <typename D>
+    bool renormalize(int i, D* x, int c, const lyapunov::Schedule& schedule)
+    {
+        const int N = lyapunov::DIM;
+        double v[N][N];
+        for (int j = 0; j < N; j++)
+            for (int k = 0; k < N; k++) v[j][k] = (double)x[k].d[j];
+        if (!accumulateGrowth(i, v, c, schedule)) return false;
+        for (int j = 0; j < N; j++)
+            for (int k = 0; k < N; k++) x[k].d[j] = T(v[j][k]);
+        return true;
+    }
+
+    // orthonormalise member i's tangents v[j] in place and add their growth
+    // since the last Gram-Schmidt to the spectrum and MEGNO; false (v left
+    // alone) when no time has passed
+    bool accumulateGrowth(int i, double (*v)[lyapunov::DIM], int c, const lyapunov::Schedule& schedule)
+    {
+        const double t = schedule.at(c), last = schedule.before(c);
+        if (!(t > last)) return false;
+        double growth[lyapunov::DIM];
+        lyapunov::orthonormalize(v, growth);
+        for (int j = 0; j < lyapunov::DIM; j++) lyapunovSum[j][i] += growth[j];
+        megnoWeighted[i] += 0.5 * (t + last) * growth[0];
+        megnoIntegral[i] += 2.0 * megnoWeighted[i] / t * (t - last);
+        return true;
+    }
+
+    // f(first, n, constants) for the float kernels on [begin, end): all at
+    // once with the shared constants k, or with per-member parameters
+    // V::width members at a time, each lane holding its member's constants
+    template <typename V, typename K, typename F>
+    void forBatches(int begin, int end, const K& k, F&& f)
+    {
+        if (!memberParams)
+        {
+            f(begin, end - begin, k);
+            return;
+        }
+        for (int i = begin; i < end; i += V::width)
+        {
+            const BasicPendulumConsts<V> lanes(V::load(paramL1.data() + i), V::load(paramL2.data() + i),
+                V::load(paramM1.data() + i), V::load(paramM2.data() + i), V::load(paramGravity.data() + i));
+            f(i, V::width, lanes);
+        }
+    }
+
+    void storeParams(int i, const SimParams& p)
+    {
+        paramL1[i] = p.l1; paramL2[i] = p.l2;
+        paramM1[i] = p.m1; paramM2[i] = p.m2;
+        paramGravity[i] = p.gravity;
+    }
+
+    // the SIMD lanes past the last member get its parameters rather than the
+    // zeros the columns are padded with, which would divide by zero
+    void padParams()
+    {
+        if (count == 0) return;
+        const SimParams last = paramsOf(SimParams(), count - 1);
+        const int line = (int)(AlignedArray<float>::ALIGNMENT / sizeof(float));
+        for (int i = count; i < (count + line - 1) / line * line; i++) storeParams(i, last);
+    }
+
+    void dropCarry()
+    {
+        for (AlignedArray<T>& column : carry)
+            memset((void*)column.data(), 0, count * sizeof(T));
+    }
+
+    // observer for the batched float steppers of members from `begin`, whose
+    // substep 0 starts at time t0: the vector test leaves only the lanes with
+    // a candidate event, refine() decides
+    template <typename V, typename K>
+    auto eventObserver(int begin, double t0, float dt, const K& k, const SimParams& params, const EventDetector& detector)
+    {
+        return [this, begin, t0, dt, &k, &params, &detector](int i, int s, V a1, V a2, V a3, V a4, V b1, V b2, V b3, V b4) {
+            if (!detector.active()) return;
+            int lanes = detector.candidates(a1, a2, a3, a4, b1, b2, b3, b4);
+            for (int l = 0; lanes; l++, lanes >>= 1)
+            {
+                int member = begin + i + l;
+                if (!(lanes & 1) || member >= count || done[member]) continue;
+                float y0[4] = { a1.lane(l), a2.lane(l), a3.lane(l), a4.lane(l) };
+                float y1[4] = { b1.lane(l), b2.lane(l), b3.lane(l), b4.lane(l) };
+                int found = memberParams
+                    ? detector.refine(id[member], t0 + (double)dt * s, (double)dt, y0, y1,
+                        BasicPendulumConsts<T>(paramsOf(params, member)), events)
+                    : detector.refine(id[member], t0 + (double)dt * s, (double)dt, y0, y1, k, events);
+                if (found & retireMask)
+                    retireAfterEvent(member, found, t0 + (double)dt * (s + 1), y1);
+            }
+            };
+    }
+
+    // called from the worker that owns member i, with its state at time t
+    void retireAfterEvent(int i, int found, double t, const T* y)
+    {
+        if (done[i]) return;
+        done[i] = 1;
+        int reason = 0;
+        while (!(found & retireMask & (1 << reason))) reason++;
+        retired.push({ id[i], (EventKind)reason, t, y[0], y[1], y[2], y[3] });
+    }
+
+    void compactIfNeeded()
+    {
+        size_t pending = retired.size() - compactedRetired;
+        if (pending && pending * COMPACT_FRACTION >= (size_t)count)
+            compact();
+    }
+
+    static bool samePhysics(const SimParams& a, const SimParams& b)
+    {
+        return a.l1 == b.l1 && a.l2 == b.l2 && a.m1 == b.m1 && a.m2 == b.m2 && a.gravity == b.gravity;
+    }
+
+    int count = 0;
+    float adaptiveDirection = 0.0f;
+    SimParams adaptiveParams;   // the model adaptiveDirection's FSAL stages belong to
+    size_t compactedRetired = 0;
+    bool energyBaseline = false;
+    SimParams energyParams;
+    int stepsSinceEnergy = 0;
+    double lastOrthoTime = 0.0;
+    int stepsSinceOrtho = 0;
+};
+
+// -------- precision switch --------
+enum class Precision
+{
+    Float,
+    Double,
+    LongDouble,     // same as Double on MSVC
+    DoubleDouble,   // ~32 digits, for reference runs
+    Count
+};
+
+inline const char* precisionName(Precision p)
+{
+    switch (p)
+    {
+    case Precision::Float: return "float";
+    case Precision::Double: return "double";
+    case Precision::LongDouble: return "long double";
+    case Precision::DoubleDouble: return "double-double";
+    default: return "?";
+    }
+}
+
+// an ensemble whose scalar type is chosen at run time
+class AnyEnsemble
+{
+public:
+    typedef std::variant<PendulumEnsemble<float>, PendulumEnsemble<double>,
+        PendulumEnsemble<long double>, PendulumEnsemble<DoubleDouble>> Storage;
+
+    // switching precision drops the members, call resize()/set() again
+    void setPrecision(Precision p)
+    {
+        if (p == precision()) return;
+        switch (p)
+        {
+        case Precision::Double: ensemble.emplace<PendulumEnsemble<double>>(); break;
+        case Precision::LongDouble: ensemble.emplace<PendulumEnsemble<long double>>(); break;
+        case Precision::DoubleDouble: ensemble.emplace<PendulumEnsemble<DoubleDouble>>(); break;
+        default: ensemble.emplace<PendulumEnsemble<float>>(); break;
+        }
+    }
+
+    Precision precision() const { return (Precision)ensemble.index(); }
+
+    // precision first, then the ensemble of that precision
+    template <typename A>
+    void serialize(A& ar)
+    {
+        int p = (int)precision();
+        ar.io(p);
+        if constexpr (A::reading)
+        {
+            ar.check(p >= 0 && p < (int)Precision::Count);
+            if (!ar.ok()) return;
+            setPrecision((Precision)p);
+        }
+        visit([&](auto& e) { e.serialize(ar); });
+    }
+
+    // f(PendulumEnsemble<T>&) on the active ensemble
+    template <typename F>
+    decltype(auto) visit(F&& f) { return std::visit(std::forward<F>(f), ensemble); }
+
+    int size() const { return std::visit([](auto& e) { return e.size(); }, ensemble); }
+
+    void resize(int n) { visit([&](auto& e) { e.resize(n); }); }
+
+    void set(int i, double initial_theta1, double initial_theta2, float hue)
+    {
+        visit([&](auto& e) {
+            typedef typename std::decay<decltype(e.theta1[0])>::type T;
+            e.set(i, T(initial_theta1), T(initial_theta2), hue);
+            });
+    }
+
+    // f(i, double* y, float& hue) as for PendulumEnsemble::setAll()
+    template <typename F>
+    void setAll(ThreadPool& pool, F&& f)
+    {
+        visit([&](auto& e) {
+            typedef typename std::decay<decltype(e.theta1[0])>::type T;
+            e.setAll(pool, [&](int i, T* y, float& hue) {
+                double v[4];
+                f(i, v, hue);
+                for (int c = 0; c < 4; c++) y[c] = T(v[c]);
+                });
+            });
+    }
+
+    void setParams(int i, const SimParams& p) { visit([&](auto& e) { e.setParams(i, p); }); }
+
+    void step(SimParams params, double dt, int steps, Integrator method, ThreadPool& pool)
+    {
+        visit([&](auto& e) {
+            typedef typename std::decay<decltype(e.theta1[0])>::type T;
+            e.step(params, T(dt), steps, method, pool);
+            });
+    }
+
+    void storePrevious() { visit([](auto& e) { e.storePrevious(); }); }
+
+    void setEventMask(int mask) { visit([&](auto& e) { e.eventMask = mask; }); }
+    void setRetireMask(int mask) { visit([&](auto& e) { e.retireMask = mask; }); }
+    size_t retiredCount() { return visit([](auto& e) { return e.retired.size(); }); }
+
+    void setEnergyMonitor(int interval, float threshold)
+    {
+        visit([&](auto& e) { e.energyInterval = interval; e.energyThreshold = threshold; });
+    }
+    EnergyStats energyStats() { return visit([](auto& e) { return e.energyStats; }); }
+
+    // interval 0 turns the Lyapunov mode off; turning it on restarts the estimates
+    void setLyapunov(int interval)
+    {
+        visit([&](auto& e) {
+            if (interval > 0 && e.lyapunovInterval <= 0) e.resetLyapunov();
+            e.lyapunovInterval = interval;
+            });
+    }
+    ChaosStats chaosStats() { return visit([](auto& e) { return e.chaosStats(); }); }
+    // mean Taylor series step so far, 0 before the first one
+    double meanTaylorStep() { return visit([](auto& e) { return e.taylorSteps ? e.taylorTime / e.taylorSteps : 0.0; }); }
+    const AppendBuffer<PendulumEvent>& events() { return visit([](auto& e) -> const AppendBuffer<PendulumEvent>& { return e.events; }); }
+    void clearEvents() { visit([](auto& e) { e.events.clear(); }); }
+    void setSection(const PoincareSection& s) { visit([&](auto& e) { e.section = s; }); }
+    const AppendBuffer<SectionPoint>& sectionPoints() { return visit([](auto& e) -> const AppendBuffer<SectionPoint>& { return e.sectionPoints; }); }
+    void clearSectionPoints() { visit([](auto& e) { e.sectionPoints.clear(); }); }
+    void updateTrails(float cx, float cy, float alpha, const SimParams& params) { visit([&](auto& e) { e.updateTrails(cx, cy, alpha, params); }); }
+    void draw(float cx, float cy, float alpha, const SimParams& params) { visit([&](auto& e) { e.draw(cx, cy, alpha, params); }); }
+
+private:
+    Storage ensemble;
+};
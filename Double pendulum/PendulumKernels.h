@@ -0,0 +1,208 @@
+﻿#pragma once
+#include "SimdMath.h"
+#include "SimParams.h"
+
+// -------- batched double pendulum kernels --------
+// Same equations as stepRK4() in Pendulum.h, but evaluated on V::width
+// pendulums at once. Only two sincos() calls are needed per evaluation:
+//   sin(th1 - 2*th2) = sin(2d - th1) with d = th1 - th2
+//   cos(2*th1 - 2*th2) = cos(d)^2 - sin(d)^2
+// The constant terms come hoisted in K: a PendulumConsts (SimParams.h) built
+// at run time, or a StaticPendulumConsts (Presets.h) the compiler folds.
+// Compared with the scalar path (double-precision libm) one RK4 step agrees to
+// a few float ulp; chaotic members of course diverge afterwards.
+
+template <typename V, typename K = PendulumConsts>
+inline void accelBatch(V th1, V th2, V w1, V w2, V& a1, V& a2, const K& k)
+{
+    V s1, c1, sd, cd;
+    simd::sincos(th1, s1, c1);
+    simd::sincos(th1 - th2, sd, cd);
+
+    V s2d = V(2.0f) * sd * cd;
+    V c2d = cd * cd - sd * sd;
+    V sTh1Minus2Th2 = s2d * c1 - c2d * s1;
+
+    V w1sq = w1 * w1;
+    V w2sq = w2 * w2;
+    V invDen = V(1.0f) / (V(k.twoM1PlusM2) - V(k.m2) * c2d);
+
+    V num1 = -(V(k.gTwoM1PlusM2) * s1) - V(k.gM2) * sTh1Minus2Th2;
+    V num2 = V(-2.0f) * sd * V(k.m2) * (w2sq * V(k.l2) + w1sq * V(k.l1) * cd);
+    a1 = (num1 + num2) * invDen * V(k.invL1);
+
+    V num3 = w1sq * V(k.l1M1PlusM2) + V(k.gM1PlusM2) * c1 + w2sq * V(k.l2M2) * cd;
+    a2 = V(2.0f) * sd * num3 * invDen * V(k.invL2);
+}
+
+// observer that does nothing; the compiler drops the state copies it would see
+struct NoStepObserver
+{
+    template <typename... A>
+    void operator()(A&&...) const {}
+};
+
+// what one RK4 step of size h adds to the state of V::width members held in
+// registers; half and sixth are h / 2 and h / 6
+template <typename V, typename K = PendulumConsts>
+inline void rk4IncrementBatch(V th1, V th2, V w1, V w2, V h, V half, V sixth, const K& k,
+    V& dTh1, V& dTh2, V& dW1, V& dW2)
+{
+    const V two(2.0f);
+    V k1_w1, k1_w2, k2_w1, k2_w2, k3_w1, k3_w2, k4_w1, k4_w2;
+
+    // --- k1 ---
+    accelBatch(th1, th2, w1, w2, k1_w1, k1_w2, k);
+    V k1_th1 = w1, k1_th2 = w2;
+
+    // --- k2 ---
+    V k2_th1 = w1 + half * k1_w1;
+    V k2_th2 = w2 + half * k1_w2;
+    accelBatch(th1 + half * k1_th1, th2 + half * k1_th2, k2_th1, k2_th2, k2_w1, k2_w2, k);
+
+    // --- k3 ---
+    V k3_th1 = w1 + half * k2_w1;
+    V k3_th2 = w2 + half * k2_w2;
+    accelBatch(th1 + half * k2_th1, th2 + half * k2_th2, k3_th1, k3_th2, k3_w1, k3_w2, k);
+
+    // --- k4 ---
+    V k4_th1 = w1 + h * k3_w1;
+    V k4_th2 = w2 + h * k3_w2;
+    accelBatch(th1 + h * k3_th1, th2 + h * k3_th2, k4_th1, k4_th2, k4_w1, k4_w2, k);
+
+    // --- combine ---
+    dTh1 = sixth * (k1_th1 + two * k2_th1 + two * k3_th1 + k4_th1);
+    dTh2 = sixth * (k1_th2 + two * k2_th2 + two * k3_th2 + k4_th2);
+    dW1 = sixth * (k1_w1 + two * k2_w1 + two * k3_w1 + k4_w1);
+    dW2 = sixth * (k1_w2 + two * k2_w2 + two * k3_w2 + k4_w2);
+}
+
+// one RK4 step of size h of V::width members held in registers
+template <typename V, typename K = PendulumConsts>
+inline void rk4StepBatch(V& th1, V& th2, V& w1, V& w2, V h, V half, V sixth, const K& k)
+{
+    V dTh1, dTh2, dW1, dW2;
+    rk4IncrementBatch(th1, th2, w1, w2, h, half, sixth, k, dTh1, dTh2, dW1, dW2);
+    th1 = th1 + dTh1;
+    th2 = th2 + dTh2;
+    w1 = w1 + dW1;
+    w2 = w2 + dW2;
+}
+
+// `substeps` RK4 steps of size dt on [0, count) of the state columns.
+// Columns must be V::width-aligned and padded to a multiple of V::width
+// (AlignedArray guarantees both); the padding lanes are stepped too.
+// After every substep observe(i, s, old state, new state) sees lanes [i, i + V::width)
+// as eight V values: theta1, theta2, omega1, omega2 before, then after.
+template <typename V, typename K = PendulumConsts, typename O = NoStepObserver>
+inline void stepRK4Batch(float* theta1, float* theta2, float* omega1, float* omega2,
+    int count, float dt, int substeps, const K& k, O&& observe = O())
+{
+    const V h(dt);
+    const V half(0.5f * dt);
+    const V sixth(dt / 6.0f);
+
+    for (int i = 0; i < count; i += V::width)
+    {
+        V th1 = V::load(theta1 + i), th2 = V::load(theta2 + i);
+        V w1 = V::load(omega1 + i), w2 = V::load(omega2 + i);
+
+        for (int s = 0; s < substeps; s++)
+        {
+            V th1Old = th1, th2Old = th2, w1Old = w1, w2Old = w2;
+            rk4StepBatch(th1, th2, w1, w2, h, half, sixth, k);
+            observe(i, s, th1Old, th2Old, w1Old, w2Old, th1, th2, w1, w2);
+        }
+
+        th1.store(theta1 + i); th2.store(theta2 + i);
+        w1.store(omega1 + i); w2.store(omega2 + i);
+    }
+}
+
+// -------- compensated float stepping for long runs --------
+// Adding a step's small increment to a float state rounds away its low bits
+// every step, and an angle that keeps flipping grows until an increment of
+// 0.01 rad keeps only a few bits. stepRK4CompensatedBatch instead
+//   - adds every increment with Kahan summation: carry holds, per column, the
+//     part the previous additions rounded off, and goes into the next one
+//   - keeps the angles in (-pi, pi] by taking off whole turns, counted in
+//     int columns, so the total angle is theta + 2 pi * winding
+// 2 pi is split into the float TWO_PI_HI and the rest TWO_PI_LO: taking a turn
+// off an angle just past pi is exact (Sterbenz) and the rest goes into the
+// carry, so wrapping adds no error either.
+const float TWO_PI_HI = 6.28318548f;
+const float TWO_PI_LO = -1.74845553e-7f;
+
+// x += d, compensated; x - c is the running sum to about twice float precision
+template <typename V>
+inline void addCompensated(V& x, V& c, V d)
+{
+    V y = d - c;
+    V t = x + y;
+    c = (t - x) - y;
+    x = t;
+}
+
+// whole turns off x (with carry c) into `turns`, leaving x in (-pi, pi] with
+// pi rounded to float (= TWO_PI_HI / 2). Rounding to nearest leaves x on
+// either end at a tie; a second turn moves -pi up to pi and anything past
+// them inside.
+template <typename V>
+inline void wrapAngle(V& x, V& c, V& turns)
+{
+    V n = V::roundNearest(x * V(float(1.0 / 6.283185307179586)));
+    x = x - n * V(TWO_PI_HI);
+    V m = V::lessEqual(x, V(-0.5f * TWO_PI_HI)) - (V(1.0f) - V::lessEqual(x, V(0.5f * TWO_PI_HI)));
+    x = x + m * V(TWO_PI_HI);
+    c = c + (n - m) * V(TWO_PI_LO);
+    turns = turns + n - m;
+}
+
+// stepRK4Batch with compensated additions and wrapped angles. carry[0..3] are
+// the carries of theta1, theta2, omega1, omega2; winding1/2 receive the turns
+// taken off. observe() sees each substep before its angles are wrapped, so
+// old and new state differ by the step alone.
+template <typename V, typename K = PendulumConsts, typename O = NoStepObserver>
+inline void stepRK4CompensatedBatch(float* theta1, float* theta2, float* omega1, float* omega2,
+    float* const* carry, int* winding1, int* winding2, int count, float dt, int substeps, const K& k, O&& observe = O())
+{
+    const V h(dt);
+    const V half(0.5f * dt);
+    const V sixth(dt / 6.0f);
+
+    for (int i = 0; i < count; i += V::width)
+    {
+        V th1 = V::load(theta1 + i), th2 = V::load(theta2 + i);
+        V w1 = V::load(omega1 + i), w2 = V::load(omega2 + i);
+        V cTh1 = V::load(carry[0] + i), cTh2 = V::load(carry[1] + i);
+        V cW1 = V::load(carry[2] + i), cW2 = V::load(carry[3] + i);
+        V turns1(0.0f), turns2(0.0f);
+
+        for (int s = 0; s < substeps; s++)
+        {
+            V th1Old = th1, th2Old = th2, w1Old = w1, w2Old = w2;
+            V dTh1, dTh2, dW1, dW2;
+            rk4IncrementBatch(th1, th2, w1, w2, h, half, sixth, k, dTh1, dTh2, dW1, dW2);
+            addCompensated(th1, cTh1, dTh1);
+            addCompensated(th2, cTh2, dTh2);
+            addCompensated(w1, cW1, dW1);
+            addCompensated(w2, cW2, dW2);
+            observe(i, s, th1Old, th2Old, w1Old, w2Old, th1, th2, w1, w2);
+            wrapAngle(th1, cTh1, turns1);
+            wrapAngle(th2, cTh2, turns2);
+        }
+
+        th1.store(theta1 + i); th2.store(theta2 + i);
+        w1.store(omega1 + i); w2.store(omega2 + i);
+        cTh1.store(carry[0] + i); cTh2.store(carry[1] + i);
+        cW1.store(carry[2] + i); cW2.store(carry[3] + i);
+        alignas(64) float t1[V::width], t2[V::width];
+        turns1.store(t1);
+        turns2.store(t2);
+        for (int l = 0; l < V::width; l++)
+        {
+            winding1[i + l] += (int)t1[l];
+            winding2[i + l] += (int)t2[l];
+        }
+    }
+}
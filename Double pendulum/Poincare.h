@@ -0,0 +1,198 @@
+﻿#pragma once
+#include <math.h>
+#include <cmath>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "Events.h"
+
+// -------- Poincare section output --------
+// The ensemble finds the crossings (PoincareSection in Events.h, located on
+// the Hermite interpolant of the step like the events) and the caller drains
+// them every frame into the two consumers here:
+//   SectionHistogram  a density image of two of the four variables for the
+//                     live scatter view; it takes any number of points at a
+//                     fixed cost per point and per frame
+//   SectionStream     an append-only file written by a background thread,
+//                     so the frame never waits on the disk
+namespace poincare
+{
+    const double PI = 3.141592653589793;
+
+    // axis names for the UI, same order as the state
+    inline const char* variableName(int v)
+    {
+        static const char* names[4] = { "theta1", "theta2", "omega1", "omega2" };
+        return v >= 0 && v < 4 ? names[v] : "off";
+    }
+
+    // counts of section points on a size x size grid: angles wrapped to
+    // [-pi, pi) around `hanging` (the rest angle), rates in [-rateRange, rateRange]
+    class SectionHistogram
+    {
+    public:
+        int xVariable = 1;
+        int yVariable = 3;
+        double hanging = PI;
+        float rateRange = 1.0f;
+
+        void reset(int size_)
+        {
+            size = size_;
+            counts.assign((size_t)size * size, 0);
+            largest = 0;
+        }
+
+        void add(const SectionPoint* points, size_t n)
+        {
+            if (!size) return;
+            for (size_t i = 0; i < n; i++)
+            {
+                int x = cellOf(xVariable, points[i].state[xVariable]);
+                int y = cellOf(yVariable, points[i].state[yVariable]);
+                if (x < 0 || y < 0) continue;
+                unsigned& c = counts[(size_t)(size - 1 - y) * size + x];    // row 0 at the top
+                if (++c > largest) largest = c;
+            }
+        }
+
+        // log density, 0 where empty and 255 for the fullest cell
+        void image(std::vector<unsigned char>& out) const
+        {
+            out.resize(counts.size());
+            const float scale = largest > 0 ? 255.0f / logf(1.0f + largest) : 0.0f;
+            for (size_t i = 0; i < counts.size(); i++)
+                out[i] = (unsigned char)(logf(1.0f + counts[i]) * scale + 0.5f);
+        }
+
+        int imageSize() const { return size; }
+
+    private:
+        // grid cell of value v of variable `var`, -1 outside the range
+        int cellOf(int var, float v) const
+        {
+            double f;
+            if (var < 2)
+            {
+                double a = fmod(v - hanging + PI, 2.0 * PI);
+                f = (a < 0.0 ? a + 2.0 * PI : a) / (2.0 * PI);
+            }
+            else
+                f = (v + rateRange) / (2.0 * rateRange);
+            if (!(f >= 0.0 && f < 1.0)) return -1;
+            return (int)(f * size);
+        }
+
+        int size = 0;
+        std::vector<unsigned> counts;
+        unsigned largest = 0;
+    };
+
+    // Section points appended to a file as 28-byte records in native byte
+    // order: double time, int32 member, float theta1, theta2, omega1, omega2.
+    // write() only copies; a background thread does the I/O. If the disk falls
+    // more than MAX_QUEUED bytes behind, further points are dropped and counted.
+    class SectionStream
+    {
+    public:
+        static const size_t RECORD = 28;
+        static const size_t MAX_QUEUED = 256u << 20;
+
+        ~SectionStream() { close(); }
+
+        bool open(const char* path)
+        {
+            close();
+            file = fopen(path, "wb");
+            if (!file) return false;
+            failed = false;
+            stopping = false;
+            written = lost = 0;
+            writer = std::thread([this] { writeLoop(); });
+            return true;
+        }
+
+        bool isOpen() const { return file != nullptr; }
+
+        void write(const SectionPoint* points, size_t n)
+        {
+            if (!file || !n) return;
+            std::vector<char> bytes(n * RECORD);
+            char* out = bytes.data();
+            for (size_t i = 0; i < n; i++, out += RECORD)
+            {
+                memcpy(out, &points[i].time, 8);
+                memcpy(out + 8, &points[i].member, 4);
+                memcpy(out + 12, points[i].state, 16);
+            }
+            std::lock_guard<std::mutex> lock(mutex);
+            if (queuedBytes + bytes.size() > MAX_QUEUED)
+            {
+                lost += n;
+                return;
+            }
+            queuedBytes += bytes.size();
+            queue.push_back(std::move(bytes));
+            wake.notify_one();
+        }
+
+        // waits for the queue to drain; false if any write failed
+        bool close()
+        {
+            if (!file) return !failed;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                stopping = true;
+                wake.notify_one();
+            }
+            writer.join();
+            failed = fclose(file) != 0 || failed;
+            file = nullptr;
+            return !failed;
+        }
+
+        // the writer thread updates these as it goes
+        size_t pointsWritten() const { std::lock_guard<std::mutex> lock(mutex); return written / RECORD; }
+        size_t pointsDropped() const { std::lock_guard<std::mutex> lock(mutex); return lost; }
+        bool hasFailed() const { std::lock_guard<std::mutex> lock(mutex); return failed; }
+
+    private:
+        void writeLoop()
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            for (;;)
+            {
+                wake.wait(lock, [this] { return stopping || !queue.empty(); });
+                if (queue.empty()) return;
+                std::vector<std::vector<char>> batch;
+                batch.swap(queue);
+                lock.unlock();
+                size_t bytes = 0;
+                bool good = true;
+                for (const std::vector<char>& b : batch)
+                {
+                    good = good && fwrite(b.data(), 1, b.size(), file) == b.size();
+                    bytes += b.size();
+                }
+                lock.lock();
+                queuedBytes -= bytes;
+                if (good) written += bytes;
+                else failed = true;
+            }
+        }
+
+        FILE* file = nullptr;
+        std::thread writer;
+        mutable std::mutex mutex;
+        std::condition_variable wake;
+        std::vector<std::vector<char>> queue;   // guarded by mutex, like the counters below
+        size_t queuedBytes = 0;
+        size_t written = 0;
+        size_t lost = 0;
+        bool stopping = false;
+        bool failed = false;
+    };
+}
@@ -0,0 +1,111 @@
+﻿#pragma once
+#include <type_traits>
+#include "SimParams.h"
+
+// -------- compile-time physical presets --------
+// A preset fixes lengths, masses and gravity at compile time. When the frame's
+// SimParams match one exactly, the RK4 kernels are instantiated with
+// StaticPendulumConsts instead of the runtime BasicPendulumConsts: every
+// constant term (2*m1 + m2, 1/l1, ...) is then a literal the compiler folds
+// into the kernel. Anything else falls back to the runtime constants.
+// Values are floats, as the UI sliders are, so a preset reproduces the
+// runtime path bit for bit.
+
+struct PresetDefault
+{
+    static constexpr const char* name = "Default";
+    static constexpr float l1 = 100.0f, l2 = 100.0f, m1 = 30.0f, m2 = 10.0f, gravity = -9.81f;
+};
+
+struct PresetEqualMasses
+{
+    static constexpr const char* name = "Equal masses";
+    static constexpr float l1 = 100.0f, l2 = 100.0f, m1 = 10.0f, m2 = 10.0f, gravity = -9.81f;
+};
+
+struct PresetShortUpperArm
+{
+    static constexpr const char* name = "Short upper arm";
+    static constexpr float l1 = 60.0f, l2 = 140.0f, m1 = 30.0f, m2 = 10.0f, gravity = -9.81f;
+};
+
+struct PresetMoon
+{
+    static constexpr const char* name = "Moon";
+    static constexpr float l1 = 100.0f, l2 = 100.0f, m1 = 30.0f, m2 = 10.0f, gravity = -1.62f;
+};
+
+// same members as BasicPendulumConsts<T>, all compile-time constants
+template <typename P, typename T>
+struct StaticPendulumConsts
+{
+    static constexpr T l1 = T(P::l1);
+    static constexpr T l2 = T(P::l2);
+    static constexpr T m2 = T(P::m2);
+    static constexpr T twoM1PlusM2 = 2 * T(P::m1) + T(P::m2);
+    static constexpr T gTwoM1PlusM2 = T(P::gravity) * twoM1PlusM2;
+    static constexpr T gM2 = T(P::gravity) * T(P::m2);
+    static constexpr T l1M1PlusM2 = T(P::l1) * (T(P::m1) + T(P::m2));
+    static constexpr T gM1PlusM2 = T(P::gravity) * (T(P::m1) + T(P::m2));
+    static constexpr T l2M2 = T(P::l2) * T(P::m2);
+    static constexpr T invL1 = T(1) / T(P::l1);
+    static constexpr T invL2 = T(1) / T(P::l2);
+};
+
+template <typename... P>
+struct PresetList
+{
+    static constexpr int count = sizeof...(P);
+
+    static const char* name(int i)
+    {
+        static const char* const names[] = { P::name... };
+        return names[i];
+    }
+
+    // copy preset i's physical parameters into p, leaving the rest alone
+    static void apply(int i, SimParams& p)
+    {
+        static const float values[][5] = { { P::l1, P::l2, P::m1, P::m2, P::gravity }... };
+        p.l1 = values[i][0]; p.l2 = values[i][1];
+        p.m1 = values[i][2]; p.m2 = values[i][3];
+        p.gravity = values[i][4];
+    }
+
+    // index of the preset p matches exactly, or -1
+    static int match(const SimParams& p)
+    {
+        const bool hit[] = { matches<P>(p)... };
+        for (int i = 0; i < count; i++)
+            if (hit[i]) return i;
+        return -1;
+    }
+
+    // f(k) with k the constants for p: StaticPendulumConsts of the matching
+    // preset, or BasicPendulumConsts<T> built at run time
+    template <typename T, typename F>
+    static void withConsts(const SimParams& p, F&& f)
+    {
+        if constexpr (std::is_floating_point<T>::value)
+            if ((tryPreset<P, T>(p, f) || ...))
+                return;
+        f(BasicPendulumConsts<T>(p));
+    }
+
+private:
+    template <typename Q>
+    static bool matches(const SimParams& p)
+    {
+        return p.l1 == Q::l1 && p.l2 == Q::l2 && p.m1 == Q::m1 && p.m2 == Q::m2 && p.gravity == Q::gravity;
+    }
+
+    template <typename Q, typename T, typename F>
+    static bool tryPreset(const SimParams& p, F& f)
+    {
+        if (!matches<Q>(p)) return false;
+        f(StaticPendulumConsts<Q, T>());
+        return true;
+    }
+};
+
+typedef PresetList<PresetDefault, PresetEqualMasses, PresetShortUpperArm, PresetMoon> Presets;
@@ -0,0 +1,176 @@
+﻿#pragma once
+#include <algorithm>
+#include <vector>
+#include "ThreadPool.h"
+
+// -------- adaptive quadtree refinement of image maps --------
+// Fills a width x height map of a per-pixel quantity (flip time, FTLE, ...)
+// coarse to fine instead of pixel by pixel. The first level samples every
+// `coarse`-th pixel. Every cell between four samples is then either
+// accepted or split:
+// - accepted when its corners fall into the same bucket of the caller's
+//   bucket(value); its pixels are filled by bilinear interpolation of the
+//   corners
+// - otherwise split into four cells of half the size, whose new corners are
+//   sampled at the next level
+// A cell one pixel wide has no inside left, so the structure that matters
+// ends up sampled exactly while smooth regions cost a few samples per cell.
+//
+// advance() does the work in slices of `budget` samples, so a frame loop can
+// show the map while it refines. Pixels not decided yet show the sample at
+// the top left of their cell on the current level.
+class QuadtreeMap
+{
+public:
+    enum PixelState : unsigned char { Unknown, Preview, Interpolated, Exact };
+
+    // samples per parallelFor chunk
+    static const int SAMPLE_CHUNK = 64;
+
+    void reset(int width_, int height_, int coarse = 16)
+    {
+        width = width_ > 0 ? width_ : 1;
+        height = height_ > 0 ? height_ : 1;
+        value.assign((size_t)width * height, 0.0f);
+        state.assign((size_t)width * height, Unknown);
+        cells.clear();
+        size = 1;
+        while (size < coarse) size *= 2;
+        for (int y = 0; y == 0 || y < height - 1; y += size)
+            for (int x = 0; x == 0 || x < width - 1; x += size)
+                cells.push_back({ x, y, size });
+        queueCorners();
+        samples = 0;
+    }
+
+    // Samples up to `budget` more pixels: evaluate(pixels, n, values) must
+    // write values[pixels[i]] for i < n and is called from the pool's threads
+    // on disjoint lists. bucket(value) -> int decides which cells split.
+    // False once the map is complete.
+    template <typename Evaluate, typename Bucket>
+    bool advance(ThreadPool& pool, int budget, Evaluate&& evaluate, Bucket&& bucket)
+    {
+        if (next == queue.size())
+        {
+            settle(bucket);
+            if (cells.empty()) return false;
+        }
+        int n = (int)std::min(queue.size() - next, (size_t)(budget > 1 ? budget : 1));
+        const int* pixels = queue.data() + next;
+        pool.parallelFor(n, SAMPLE_CHUNK, [&](int begin, int end) {
+            evaluate(pixels + begin, end - begin, value.data());
+            });
+        for (int i = 0; i < n; i++) state[pixels[i]] = Exact;
+        for (int i = 0; i < n; i++) preview(pixels[i]);
+        next += n;
+        samples += n;
+        return true;
+    }
+
+    bool done() const { return cells.empty(); }
+    int mapWidth() const { return width; }
+    int mapHeight() const { return height; }
+    const std::vector<float>& values() const { return value; }
+    const std::vector<unsigned char>& states() const { return state; }
+    size_t sampled() const { return samples; }     // pixels evaluated so far
+    int cellSize() const { return size; }          // cell size of the current level
+
+private:
+    struct Cell
+    {
+        int x, y, size;
+    };
+
+    int x1Of(const Cell& c) const { return std::min(c.x + c.size, width - 1); }
+    int y1Of(const Cell& c) const { return std::min(c.y + c.size, height - 1); }
+
+    // the corners of `cells` not sampled yet, row-major
+    void queueCorners()
+    {
+        queue.clear();
+        next = 0;
+        for (const Cell& c : cells)
+        {
+            const int xs[2] = { c.x, x1Of(c) }, ys[2] = { c.y, y1Of(c) };
+            for (int y : ys)
+                for (int x : xs)
+                    if (state[(size_t)y * width + x] != Exact)
+                        queue.push_back(y * width + x);
+        }
+        std::sort(queue.begin(), queue.end());
+        queue.erase(std::unique(queue.begin(), queue.end()), queue.end());
+    }
+
+    // all corners of the level are known: accept or split every cell
+    template <typename Bucket>
+    void settle(Bucket& bucket)
+    {
+        std::vector<Cell> children;
+        const int half = size / 2;
+        for (const Cell& c : cells)
+        {
+            const int x1 = x1Of(c), y1 = y1Of(c);
+            if (x1 - c.x <= 1 && y1 - c.y <= 1) continue;     // nothing inside
+            const float v00 = value[(size_t)c.y * width + c.x], v10 = value[(size_t)c.y * width + x1];
+            const float v01 = value[(size_t)y1 * width + c.x], v11 = value[(size_t)y1 * width + x1];
+            const int b = bucket(v00);
+            if (b == bucket(v10) && b == bucket(v01) && b == bucket(v11))
+            {
+                interpolate(c.x, c.y, x1, y1, v00, v10, v01, v11);
+                continue;
+            }
+            for (int dy = 0; dy < 2; dy++)
+                for (int dx = 0; dx < 2; dx++)
+                {
+                    Cell child = { c.x + dx * half, c.y + dy * half, half };
+                    if ((dx && child.x >= x1) || (dy && child.y >= y1)) continue;
+                    children.push_back(child);
+                }
+        }
+        cells.swap(children);
+        size = half;
+        queueCorners();
+    }
+
+    void interpolate(int x0, int y0, int x1, int y1, float v00, float v10, float v01, float v11)
+    {
+        const float invX = x1 > x0 ? 1.0f / (x1 - x0) : 0.0f;
+        const float invY = y1 > y0 ? 1.0f / (y1 - y0) : 0.0f;
+        for (int y = y0; y <= y1; y++)
+        {
+            float fy = (y - y0) * invY;
+            float left = v00 + (v01 - v00) * fy, right = v10 + (v11 - v10) * fy;
+            for (int x = x0; x <= x1; x++)
+            {
+                size_t p = (size_t)y * width + x;
+                if (state[p] == Exact) continue;
+                value[p] = left + (right - left) * ((x - x0) * invX);
+                state[p] = Interpolated;
+            }
+        }
+    }
+
+    // show a fresh sample over the undecided pixels of the cell below-right of it
+    void preview(int pixel)
+    {
+        const int px = pixel % width, py = pixel / width;
+        const int xe = std::min(px + size, width), ye = std::min(py + size, height);
+        for (int y = py; y < ye; y++)
+            for (int x = px; x < xe; x++)
+            {
+                size_t p = (size_t)y * width + x;
+                if (state[p] > Preview) continue;
+                value[p] = value[pixel];
+                state[p] = Preview;
+            }
+    }
+
+    int width = 0, height = 0;
+    int size = 1;                       // cell size of the current level
+    std::vector<float> value;
+    std::vector<unsigned char> state;   // PixelState
+    std::vector<Cell> cells;            // cells of the current level
+    std::vector<int> queue;             // their corners still to sample
+    size_t next = 0;                    // queue[0, next) is done
+    size_t samples = 0;
+};
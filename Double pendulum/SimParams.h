@@ -0,0 +1,92 @@
+﻿#pragma once
+#include <atomic>
+
+// -------- per-frame simulation parameters --------
+// The UI edits the g_* globals; once per frame main() copies them into a
+// SimParams and publishes it. The simulation only ever sees that immutable
+// snapshot, passed by value, so worker threads never read a value an ImGui
+// slider is writing.
+struct SimParams
+{
+    float l1 = 100.0f;
+    float l2 = 100.0f;
+    float m1 = 30.0f;
+    float m2 = 10.0f;
+    float gravity = -9.81f;
+
+    // Dormand-Prince and Taylor series tolerances
+    float rtol = 1e-5f;
+    float atol = 1e-6f;
+};
+
+// -------- single-writer, single-reader snapshot channel --------
+// Triple buffer: the writer fills its private back slot and swaps it into the
+// shared middle slot, the reader swaps the middle slot with its private front
+// slot when a newer value is there. Neither side blocks or allocates, and the
+// value returned by latest() stays valid until the reader calls it again.
+template <typename T>
+class SnapshotChannel
+{
+public:
+    // writer side
+    void publish(const T& value)
+    {
+        slots[back].value = value;
+        back = middle.exchange(back | FRESH, std::memory_order_acq_rel) & INDEX;
+    }
+
+    // reader side
+    const T& latest()
+    {
+        if (middle.load(std::memory_order_relaxed) & FRESH)
+            front = middle.exchange(front, std::memory_order_acq_rel) & INDEX;
+        return slots[front].value;
+    }
+
+private:
+    static const int INDEX = 3;
+    static const int FRESH = 4;
+
+    // one cache line per slot so the two sides never share one
+    struct alignas(64) Slot { T value{}; };
+
+    Slot slots[3];
+    std::atomic<int> middle{ 1 };
+    int back = 2;   // owned by the writer
+    int front = 0;  // owned by the reader
+};
+
+// -------- hoisted constants of the equations of motion --------
+// Built once per step() call from a snapshot rather than once per evaluation.
+template <typename T>
+struct BasicPendulumConsts
+{
+    T l1, l2;
+    T m2;
+    T twoM1PlusM2;      // 2*m1 + m2
+    T gTwoM1PlusM2;     // g*(2*m1 + m2)
+    T gM2;              // g*m2
+    T l1M1PlusM2;       // l1*(m1 + m2)
+    T gM1PlusM2;        // g*(m1 + m2)
+    T l2M2;             // l2*m2
+    T invL1, invL2;
+
+    BasicPendulumConsts(T l1_, T l2_, T m1, T m2_, T g)
+    {
+        l1 = l1_; l2 = l2_;
+        m2 = m2_;
+        twoM1PlusM2 = 2 * m1 + m2;
+        gTwoM1PlusM2 = g * twoM1PlusM2;
+        gM2 = g * m2;
+        l1M1PlusM2 = l1 * (m1 + m2);
+        gM1PlusM2 = g * (m1 + m2);
+        l2M2 = l2 * m2;
+        invL1 = T(1) / l1;
+        invL2 = T(1) / l2;
+    }
+
+    explicit BasicPendulumConsts(const SimParams& p)
+        : BasicPendulumConsts(T(p.l1), T(p.l2), T(p.m1), T(p.m2), T(p.gravity)) {}
+};
+
+typedef BasicPendulumConsts<float> PendulumConsts;
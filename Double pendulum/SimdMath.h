@@ -0,0 +1,456 @@
+﻿#pragma once
+#include <math.h>
+#include <cmath>
+
+#if defined(__AVX512F__) || defined(__AVX2__) || defined(__SSE2__) || defined(_M_X64)
+#include <immintrin.h>
+#endif
+
+// -------- float SIMD vectors --------
+// simd::vfloat is the widest vector the compiler was allowed to target:
+// 16 lanes with AVX-512, 8 with AVX2, 4 with SSE2 and a single lane elsewhere.
+// The scalar lane type (simd::vfloat1) is always available and runs exactly the
+// same sin/cos polynomial, so it doubles as the reference for the wide kernels.
+//
+// sincos() accuracy, measured against double-precision sin/cos rounded to float
+// over |x| <= 1000 (the range the pendulum kernels actually see), identical for
+// every lane width:
+//   sin, cos: max 2 ulp where |result| > 1e-3, max 9.2e-8 absolute error
+// The reduction is a three-part Cody-Waite split of pi/2 and stays exact while
+// |x| < 2^16 * pi/2; beyond that the error grows with |x|.
+
+#if defined(__FMA__) || (defined(_MSC_VER) && defined(__AVX2__))
+#define SIMD_HAS_FMA 1
+#else
+#define SIMD_HAS_FMA 0
+#endif
+
+// Deterministic builds (define SIMD_DETERMINISTIC=1) never fuse a multiply and
+// an add, so every lane width and every CPU, FMA or not, rounds the same way,
+// and the scalar float and double code uses the polynomials below instead of
+// the C library (simd::sinCos, simd::scalarLog, simd::scalarExp and
+// simd::scalarPow). The compiler must not contract a * b + c on its own either:
+// MSVC's default /fp:precise does not; GCC and Clang need -ffp-contract=off.
+// Without it fmadd() fuses whenever the target has FMA, in every lane width.
+#ifndef SIMD_DETERMINISTIC
+#define SIMD_DETERMINISTIC 0
+#endif
+
+#if SIMD_HAS_FMA && !SIMD_DETERMINISTIC
+#define SIMD_FUSED 1
+#else
+#define SIMD_FUSED 0
+#endif
+
+template <typename T, int N>
+struct Dual;
+
+namespace simd
+{
+    // pi/2 split so that j * PIO2_1 is exact for |j| < 2^16
+    const float PIO2_1 = 1.5703125f;
+    const float PIO2_2 = 4.837512969970703125e-4f;
+    const float PIO2_3 = 7.54978995489188216e-8f;
+    const float TWO_OVER_PI = 0.636619772367581343f;
+
+    // ---- single lane ----
+    struct vfloat1
+    {
+        static const int width = 1;
+        float v;
+
+        vfloat1() = default;
+        vfloat1(float x) : v(x) {}
+
+        static vfloat1 load(const float* p) { return vfloat1(*p); }
+        void store(float* p) const { *p = v; }
+        float lane(int) const { return v; }
+
+        // bit l set when lane l has its sign bit set
+        static int signMask(vfloat1 a) { return signbit(a.v) ? 1 : 0; }
+
+        friend vfloat1 operator+(vfloat1 a, vfloat1 b) { return a.v + b.v; }
+        friend vfloat1 operator-(vfloat1 a, vfloat1 b) { return a.v - b.v; }
+        friend vfloat1 operator*(vfloat1 a, vfloat1 b) { return a.v * b.v; }
+        friend vfloat1 operator/(vfloat1 a, vfloat1 b) { return a.v / b.v; }
+        friend vfloat1 operator-(vfloat1 a) { return -a.v; }
+
+        static vfloat1 roundNearest(vfloat1 a) { return nearbyintf(a.v); }
+
+        // 1 in the lanes where a <= b, 0 elsewhere
+        static vfloat1 lessEqual(vfloat1 a, vfloat1 b) { return a.v <= b.v ? 1.0f : 0.0f; }
+
+        // quadrant fix-up: j is the (integral) multiple of pi/2 removed from x
+        static void quadrant(vfloat1 j, vfloat1 sr, vfloat1 cr, vfloat1& s, vfloat1& c)
+        {
+            int q = (int)j.v;
+            float sv = (q & 1) ? cr.v : sr.v;
+            float cv = (q & 1) ? sr.v : cr.v;
+            s = (q & 2) ? -sv : sv;
+            c = ((q + 1) & 2) ? -cv : cv;
+        }
+    };
+
+#if defined(__SSE2__) || defined(_M_X64)
+    // ---- SSE2, 4 lanes ----
+    struct vfloat4
+    {
+        static const int width = 4;
+        __m128 v;
+
+        vfloat4() = default;
+        vfloat4(__m128 x) : v(x) {}
+        vfloat4(float x) : v(_mm_set1_ps(x)) {}
+
+        static vfloat4 load(const float* p) { return _mm_load_ps(p); }
+        void store(float* p) const { _mm_store_ps(p, v); }
+        float lane(int i) const { alignas(16) float t[4]; _mm_store_ps(t, v); return t[i]; }
+
+        static int signMask(vfloat4 a) { return _mm_movemask_ps(a.v); }
+
+        friend vfloat4 operator+(vfloat4 a, vfloat4 b) { return _mm_add_ps(a.v, b.v); }
+        friend vfloat4 operator-(vfloat4 a, vfloat4 b) { return _mm_sub_ps(a.v, b.v); }
+        friend vfloat4 operator*(vfloat4 a, vfloat4 b) { return _mm_mul_ps(a.v, b.v); }
+        friend vfloat4 operator/(vfloat4 a, vfloat4 b) { return _mm_div_ps(a.v, b.v); }
+        friend vfloat4 operator-(vfloat4 a) { return _mm_xor_ps(a.v, _mm_set1_ps(-0.0f)); }
+
+        static vfloat4 roundNearest(vfloat4 a) { return _mm_cvtepi32_ps(_mm_cvtps_epi32(a.v)); }
+
+        static vfloat4 lessEqual(vfloat4 a, vfloat4 b) { return _mm_and_ps(_mm_cmple_ps(a.v, b.v), _mm_set1_ps(1.0f)); }
+
+        static void quadrant(vfloat4 j, vfloat4 sr, vfloat4 cr, vfloat4& s, vfloat4& c)
+        {
+            __m128i q = _mm_cvtps_epi32(j.v);
+            __m128 swap = _mm_castsi128_ps(_mm_cmpeq_epi32(
+                _mm_and_si128(q, _mm_set1_epi32(1)), _mm_set1_epi32(1)));
+            __m128 sv = _mm_or_ps(_mm_and_ps(swap, cr.v), _mm_andnot_ps(swap, sr.v));
+            __m128 cv = _mm_or_ps(_mm_and_ps(swap, sr.v), _mm_andnot_ps(swap, cr.v));
+            // bit 1 of q (resp. q + 1) moved into the sign bit
+            __m128 ssign = _mm_castsi128_ps(_mm_slli_epi32(_mm_and_si128(q, _mm_set1_epi32(2)), 30));
+            __m128 csign = _mm_castsi128_ps(_mm_slli_epi32(
+                _mm_and_si128(_mm_add_epi32(q, _mm_set1_epi32(1)), _mm_set1_epi32(2)), 30));
+            s = _mm_xor_ps(sv, ssign);
+            c = _mm_xor_ps(cv, csign);
+        }
+    };
+#endif
+
+#if defined(__AVX2__)
+    // ---- AVX2, 8 lanes ----
+    struct vfloat8
+    {
+        static const int width = 8;
+        __m256 v;
+
+        vfloat8() = default;
+        vfloat8(__m256 x) : v(x) {}
+        vfloat8(float x) : v(_mm256_set1_ps(x)) {}
+
+        static vfloat8 load(const float* p) { return _mm256_load_ps(p); }
+        void store(float* p) const { _mm256_store_ps(p, v); }
+        float lane(int i) const { alignas(32) float t[8]; _mm256_store_ps(t, v); return t[i]; }
+
+        static int signMask(vfloat8 a) { return _mm256_movemask_ps(a.v); }
+
+        friend vfloat8 operator+(vfloat8 a, vfloat8 b) { return _mm256_add_ps(a.v, b.v); }
+        friend vfloat8 operator-(vfloat8 a, vfloat8 b) { return _mm256_sub_ps(a.v, b.v); }
+        friend vfloat8 operator*(vfloat8 a, vfloat8 b) { return _mm256_mul_ps(a.v, b.v); }
+        friend vfloat8 operator/(vfloat8 a, vfloat8 b) { return _mm256_div_ps(a.v, b.v); }
+        friend vfloat8 operator-(vfloat8 a) { return _mm256_xor_ps(a.v, _mm256_set1_ps(-0.0f)); }
+
+        static vfloat8 roundNearest(vfloat8 a)
+        {
+            return _mm256_round_ps(a.v, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+        }
+
+        static vfloat8 lessEqual(vfloat8 a, vfloat8 b)
+        {
+            return _mm256_and_ps(_mm256_cmp_ps(a.v, b.v, _CMP_LE_OQ), _mm256_set1_ps(1.0f));
+        }
+
+        static void quadrant(vfloat8 j, vfloat8 sr, vfloat8 cr, vfloat8& s, vfloat8& c)
+        {
+            __m256i q = _mm256_cvtps_epi32(j.v);
+            __m256 swap = _mm256_castsi256_ps(_mm256_cmpeq_epi32(
+                _mm256_and_si256(q, _mm256_set1_epi32(1)), _mm256_set1_epi32(1)));
+            __m256 sv = _mm256_blendv_ps(sr.v, cr.v, swap);
+            __m256 cv = _mm256_blendv_ps(cr.v, sr.v, swap);
+            __m256 ssign = _mm256_castsi256_ps(_mm256_slli_epi32(
+                _mm256_and_si256(q, _mm256_set1_epi32(2)), 30));
+            __m256 csign = _mm256_castsi256_ps(_mm256_slli_epi32(
+                _mm256_and_si256(_mm256_add_epi32(q, _mm256_set1_epi32(1)), _mm256_set1_epi32(2)), 30));
+            s = _mm256_xor_ps(sv, ssign);
+            c = _mm256_xor_ps(cv, csign);
+        }
+    };
+#endif
+
+#if defined(__AVX512F__)
+    // ---- AVX-512, 16 lanes ----
+    struct vfloat16
+    {
+        static const int width = 16;
+        __m512 v;
+
+        vfloat16() = default;
+        vfloat16(__m512 x) : v(x) {}
+        vfloat16(float x) : v(_mm512_set1_ps(x)) {}
+
+        static vfloat16 load(const float* p) { return _mm512_load_ps(p); }
+        void store(float* p) const { _mm512_store_ps(p, v); }
+        float lane(int i) const { alignas(64) float t[16]; _mm512_store_ps(t, v); return t[i]; }
+
+        static int signMask(vfloat16 a)
+        {
+            return _mm512_test_epi32_mask(_mm512_castps_si512(a.v), _mm512_set1_epi32((int)0x80000000));
+        }
+
+        friend vfloat16 operator+(vfloat16 a, vfloat16 b) { return _mm512_add_ps(a.v, b.v); }
+        friend vfloat16 operator-(vfloat16 a, vfloat16 b) { return _mm512_sub_ps(a.v, b.v); }
+        friend vfloat16 operator*(vfloat16 a, vfloat16 b) { return _mm512_mul_ps(a.v, b.v); }
+        friend vfloat16 operator/(vfloat16 a, vfloat16 b) { return _mm512_div_ps(a.v, b.v); }
+        friend vfloat16 operator-(vfloat16 a)
+        {
+            return _mm512_castsi512_ps(_mm512_xor_si512(_mm512_castps_si512(a.v),
+                _mm512_set1_epi32((int)0x80000000)));
+        }
+
+        static vfloat16 roundNearest(vfloat16 a)
+        {
+            return _mm512_roundscale_ps(a.v, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+        }
+
+        static vfloat16 lessEqual(vfloat16 a, vfloat16 b)
+        {
+            return _mm512_maskz_mov_ps(_mm512_cmp_ps_mask(a.v, b.v, _CMP_LE_OQ), _mm512_set1_ps(1.0f));
+        }
+
+        static void quadrant(vfloat16 j, vfloat16 sr, vfloat16 cr, vfloat16& s, vfloat16& c)
+        {
+            __m512i q = _mm512_cvtps_epi32(j.v);
+            __mmask16 swap = _mm512_test_epi32_mask(q, _mm512_set1_epi32(1));
+            __m512 sv = _mm512_mask_blend_ps(swap, sr.v, cr.v);
+            __m512 cv = _mm512_mask_blend_ps(swap, cr.v, sr.v);
+            __m512i ssign = _mm512_slli_epi32(_mm512_and_si512(q, _mm512_set1_epi32(2)), 30);
+            __m512i csign = _mm512_slli_epi32(
+                _mm512_and_si512(_mm512_add_epi32(q, _mm512_set1_epi32(1)), _mm512_set1_epi32(2)), 30);
+            s = _mm512_castsi512_ps(_mm512_xor_si512(_mm512_castps_si512(sv), ssign));
+            c = _mm512_castsi512_ps(_mm512_xor_si512(_mm512_castps_si512(cv), csign));
+        }
+    };
+#endif
+
+#if defined(__AVX512F__)
+    typedef vfloat16 vfloat;
+#elif defined(__AVX2__)
+    typedef vfloat8 vfloat;
+#elif defined(__SSE2__) || defined(_M_X64)
+    typedef vfloat4 vfloat;
+#else
+    typedef vfloat1 vfloat;
+#endif
+
+    // a * b + c, fused when the target has FMA and the build is not deterministic
+    inline vfloat1 fmadd(vfloat1 a, vfloat1 b, vfloat1 c)
+    {
+#if SIMD_FUSED
+        return fmaf(a.v, b.v, c.v);
+#else
+        return a * b + c;
+#endif
+    }
+#if defined(__SSE2__) || defined(_M_X64)
+    inline vfloat4 fmadd(vfloat4 a, vfloat4 b, vfloat4 c)
+    {
+#if SIMD_FUSED
+        return _mm_fmadd_ps(a.v, b.v, c.v);
+#else
+        return a * b + c;
+#endif
+    }
+#endif
+#if defined(__AVX2__)
+    inline vfloat8 fmadd(vfloat8 a, vfloat8 b, vfloat8 c)
+    {
+#if SIMD_FUSED
+        return _mm256_fmadd_ps(a.v, b.v, c.v);
+#else
+        return a * b + c;
+#endif
+    }
+#endif
+#if defined(__AVX512F__)
+    inline vfloat16 fmadd(vfloat16 a, vfloat16 b, vfloat16 c)
+    {
+#if SIMD_FUSED
+        return _mm512_fmadd_ps(a.v, b.v, c.v);
+#else
+        return a * b + c;
+#endif
+    }
+#endif
+
+    // sin(x) and cos(x) together, Cephes sinf/cosf minimax polynomials on [-pi/4, pi/4]
+    template <typename V>
+    inline void sincos(V x, V& s, V& c)
+    {
+        V j = V::roundNearest(x * V(TWO_OVER_PI));
+        V r = x - j * V(PIO2_1);
+        r = r - j * V(PIO2_2);
+        r = r - j * V(PIO2_3);
+        V r2 = r * r;
+
+        V ps = fmadd(fmadd(V(-1.9515295891e-4f), r2, V(8.3321608736e-3f)), r2, V(-1.6666654611e-1f));
+        V sr = fmadd(ps * r2, r, r);
+
+        V pc = fmadd(fmadd(V(2.443315711809948e-5f), r2, V(-1.388731625493765e-3f)), r2, V(4.166664568298827e-2f));
+        V cr = fmadd(pc * r2, r2, fmadd(V(-0.5f), r2, V(1.0f)));
+
+        V::quadrant(j, sr, cr, s, c);
+    }
+
+    // sin and cos of a scalar for the templated integrators; T is found by
+    // ADL so user-defined scalar types work. Deterministic builds send float
+    // and double through the polynomials here instead of the C library; long
+    // double keeps it, its format differs between compilers anyway.
+    template <typename T>
+    inline T scalarSin(T x) { using std::sin; return sin(x); }
+
+    template <typename T>
+    inline T scalarCos(T x) { using std::cos; return cos(x); }
+
+    template <typename T>
+    inline void sinCos(T x, T& s, T& c)
+    {
+        s = scalarSin(x);
+        c = scalarCos(x);
+    }
+
+    // log, exp and pow (x > 0) for step size control and the Lyapunov sums
+    template <typename T>
+    inline T scalarLog(T x) { using std::log; return log(x); }
+
+    template <typename T>
+    inline T scalarExp(T x) { using std::exp; return exp(x); }
+
+    template <typename T>
+    inline T scalarPow(T x, T y) { using std::pow; return pow(x, y); }
+
+    // defined in Dual.h; declared here so the templates that call
+    // simd::sinCos(), sincos(), scalarSin() and scalarCos() see them
+    template <typename T, int N>
+    void sinCos(const Dual<T, N>& x, Dual<T, N>& s, Dual<T, N>& c);
+    template <typename T, int N>
+    void sincos(const Dual<T, N>& x, Dual<T, N>& s, Dual<T, N>& c);
+    template <typename T, int N>
+    Dual<T, N> scalarSin(const Dual<T, N>& x);
+    template <typename T, int N>
+    Dual<T, N> scalarCos(const Dual<T, N>& x);
+
+    // vectors (e.g. inside Dual<simd::vfloat, N>) use the polynomial
+    inline void sinCos(vfloat1 x, vfloat1& s, vfloat1& c) { sincos(x, s, c); }
+#if defined(__SSE2__) || defined(_M_X64)
+    inline void sinCos(vfloat4 x, vfloat4& s, vfloat4& c) { sincos(x, s, c); }
+#endif
+#if defined(__AVX2__)
+    inline void sinCos(vfloat8 x, vfloat8& s, vfloat8& c) { sincos(x, s, c); }
+#endif
+#if defined(__AVX512F__)
+    inline void sinCos(vfloat16 x, vfloat16& s, vfloat16& c) { sincos(x, s, c); }
+#endif
+
+#if SIMD_DETERMINISTIC
+    inline void sinCos(float x, float& s, float& c)
+    {
+        vfloat1 vs, vc;
+        sincos(vfloat1(x), vs, vc);
+        s = vs.v;
+        c = vc.v;
+    }
+
+    inline float scalarSin(float x) { float s, c; sinCos(x, s, c); return s; }
+    inline float scalarCos(float x) { float s, c; sinCos(x, s, c); return c; }
+
+    // Cephes sin/cos minimax polynomials on [-pi/4, pi/4] after a three-part
+    // Cody-Waite reduction by pi/2 (fdlibm's split, exact while |x| < 2^20 pi/2);
+    // within 2 ulp of the C library over |x| <= 1000
+    inline void sinCos(double x, double& s, double& c)
+    {
+        const double PIO2_1D = 1.57079632673412561417e+00;
+        const double PIO2_2D = 6.07710050630396597660e-11;
+        const double PIO2_3D = 2.02226624871116645580e-21;
+        double j = std::nearbyint(x * 6.36619772367581382433e-01);
+        double r = x - j * PIO2_1D;
+        r = r - j * PIO2_2D;
+        r = r - j * PIO2_3D;
+        double r2 = r * r;
+
+        double ps = ((((1.58962301576546568060e-10 * r2 - 2.50507477628578072866e-8) * r2
+            + 2.75573136213857245213e-6) * r2 - 1.98412698295895385996e-4) * r2
+            + 8.33333333332211858878e-3) * r2 - 1.66666666666666307295e-1;
+        double sr = r + r * r2 * ps;
+
+        double pc = ((((-1.13585365213876817300e-11 * r2 + 2.08757008419747316778e-9) * r2
+            - 2.75573141792967388112e-7) * r2 + 2.48015872888517045348e-5) * r2
+            - 1.38888888888730564116e-3) * r2 + 4.16666666666665929218e-2;
+        double cr = 1.0 - 0.5 * r2 + r2 * r2 * pc;
+
+        switch ((long long)j & 3)
+        {
+        case 0: s = sr; c = cr; break;
+        case 1: s = cr; c = -sr; break;
+        case 2: s = -sr; c = -cr; break;
+        default: s = -cr; c = sr; break;
+        }
+    }
+
+    inline double scalarSin(double x) { double s, c; sinCos(x, s, c); return s; }
+    inline double scalarCos(double x) { double s, c; sinCos(x, s, c); return c; }
+
+    // Cephes log: x = m 2^e with m in [sqrt(1/2), sqrt(2)), a rational
+    // approximation of log(m) and ln 2 split in two; x > 0 and finite
+    inline double scalarLog(double x)
+    {
+        if (!(x > 0.0) || x == HUGE_VAL)
+            return x == 0.0 ? -HUGE_VAL : x < 0.0 ? NAN : x;
+        int e;
+        double m = std::frexp(x, &e);
+        if (m < 7.07106781186547524401e-1)
+        {
+            e -= 1;
+            m = 2.0 * m - 1.0;
+        }
+        else
+            m = m - 1.0;
+        double z = m * m;
+        double p = ((((1.01875663804580931796e-4 * m + 4.97494994976747001425e-1) * m
+            + 4.70579119878881725854e0) * m + 1.44989225341610930846e1) * m
+            + 1.79368678507819816313e1) * m + 7.70838733755885391666e0;
+        double q = ((((m + 1.12873587189167450590e1) * m + 4.52279145837532221105e1) * m
+            + 8.29875266912776603211e1) * m + 7.11544750618563894466e1) * m
+            + 2.31251620126765340583e1;
+        double y = m * (z * p / q) - e * 2.121944400546905827679e-4 - 0.5 * z;
+        return m + y + e * 0.693359375;
+    }
+
+    // Cephes exp: x = n ln 2 + r with |r| <= ln 2 / 2, a Pade approximant of
+    // exp(r) and a scale by 2^n
+    inline double scalarExp(double x)
+    {
+        if (x != x) return x;
+        if (x > 709.782712893384) return HUGE_VAL;
+        if (x < -745.2) return 0.0;
+        double n = std::floor(1.4426950408889634074 * x + 0.5);
+        double r = x - n * 6.93145751953125e-1;
+        r = r - n * 1.42860682030941723212e-6;
+        double r2 = r * r;
+        double p = r * ((1.26177193074810590878e-4 * r2 + 3.02994407707441961300e-2) * r2
+            + 9.99999999999999999910e-1);
+        double q = ((3.00198505138664455042e-6 * r2 + 2.52448340349684104192e-3) * r2
+            + 2.27265548208155028766e-1) * r2 + 2.00000000000000000009e0;
+        return std::ldexp(1.0 + 2.0 * (p / (q - p)), (int)n);
+    }
+
+    inline double scalarPow(double x, double y) { return scalarExp(y * scalarLog(x)); }
+#endif
+}
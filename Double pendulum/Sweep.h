@@ -0,0 +1,79 @@
+﻿#pragma once
+#include <math.h>
+#include <cmath>
+#include "SimParams.h"
+#include "SimdMath.h"
+
+// -------- parameter sweeps --------
+// A sweep gives every member of the ensemble its own value of one physical
+// parameter, spread from `from` to `to` over the members, the others staying
+// at the frame's. The members then step as one ensemble (per-member
+// parameters, PendulumEnsemble::setParams()), lanes with different masses or
+// lengths side by side in the SIMD kernels.
+namespace sweep
+{
+    enum class Parameter
+    {
+        None,
+        MassRatio,      // m2 / m1, m1 as in the parameters
+        LengthRatio,    // l2 / l1, l1 as in the parameters
+        Gravity,        // |g|, with the sign of the parameters' gravity
+        Count
+    };
+
+    inline const char* parameterName(Parameter p)
+    {
+        switch (p)
+        {
+        case Parameter::None: return "none";
+        case Parameter::MassRatio: return "m2/m1";
+        case Parameter::LengthRatio: return "l2/l1";
+        case Parameter::Gravity: return "|g|";
+        default: return "?";
+        }
+    }
+
+    inline void defaultRange(Parameter p, float& from, float& to)
+    {
+        switch (p)
+        {
+        case Parameter::Gravity: from = 1.0f; to = 30.0f; break;
+        default: from = 0.1f; to = 10.0f; break;
+        }
+    }
+
+    struct Settings
+    {
+        Parameter parameter = Parameter::None;
+        float from = 0.1f;
+        float to = 10.0f;
+        bool logarithmic = true;    // geometric spacing, as ratios want
+
+        bool active() const { return parameter != Parameter::None; }
+
+        // value of member i of n
+        float value(int i, int n) const
+        {
+            if (n < 2) return from;
+            double t = (double)i / (n - 1);
+            if (logarithmic && from > 0.0f && to > 0.0f)
+                return (float)(from * simd::scalarPow((double)to / from, t));
+            return (float)(from + (to - from) * t);
+        }
+
+        // the parameters of member i of n, starting from the frame's
+        SimParams member(const SimParams& base, int i, int n) const
+        {
+            SimParams p = base;
+            float v = value(i, n);
+            switch (parameter)
+            {
+            case Parameter::MassRatio: p.m2 = v * base.m1; break;
+            case Parameter::LengthRatio: p.l2 = v * base.l1; break;
+            case Parameter::Gravity: p.gravity = base.gravity < 0.0f ? -v : v; break;
+            default: break;
+            }
+            return p;
+        }
+    };
+}
@@ -0,0 +1,187 @@
+﻿#pragma once
+#include <math.h>
+#include <cmath>
+#include "Pendulum.h"
+
+// -------- Taylor series integrator --------
+// For reference trajectories: each step expands the solution in a Taylor
+// series around the current state, y(t0 + h) = sum of c[n] h^n, to an order
+// chosen from the tolerance, and takes the largest step the last terms allow.
+// The coefficients come from automatic differentiation of accelerations()
+// by recurrence: every intermediate term of the formula gets its own series,
+// and coefficient n of a product, quotient, sine or cosine follows from the
+// coefficients 0..n of its operands (Jorba & Zou 2005, "A software package
+// for the numerical integration of ODEs by means of high-order Taylor
+// methods"). One step of order p costs O(p^2) operations and two sin/cos
+// pairs; at 1e-14 it runs at order ~18 with steps of a good fraction of a
+// period, where RK4 would need a step well under dt = 0.01.
+// State vectors are ordered { theta1, theta2, omega1, omega2 }. Nothing is
+// kept between calls: the order and step follow from the series at each step.
+template <typename T>
+struct TaylorSeries
+{
+    static const int MIN_ORDER = 6;
+    static const int MAX_ORDER = 40;
+
+    // give up refining below this fraction of the requested span
+    static constexpr double MIN_STEP_FRACTION = 1e-6;
+
+    BasicPendulumConsts<T> k;
+    double rtol;
+    double atol;
+
+    TaylorSeries(const BasicPendulumConsts<T>& k_, double rtol_, double atol_) : k(k_), rtol(rtol_), atol(atol_) {}
+
+    // Jorba & Zou's order: the cost per unit time is lowest near
+    // p = -ln(eps) / 2 + 1, where eps is the tolerance that dominates at y
+    int order(const T* y) const
+    {
+        double eps = rtol * norm(y) > atol ? rtol : atol;
+        int p = (int)ceil(-0.5 * simd::scalarLog(eps)) + 1;
+        return p < MIN_ORDER ? MIN_ORDER : p > MAX_ORDER ? MAX_ORDER : p;
+    }
+
+    // fill the state series to order p at y
+    void expand(const T* y, int p)
+    {
+        th1[0] = y[0]; th2[0] = y[1];
+        w1[0] = y[2]; w2[0] = y[3];
+        for (int n = 0; n < p; n++)
+        {
+            // the terms of accelerations(), coefficient n of each
+            d[n] = th1[n] - th2[n];
+            if (n == 0)
+            {
+                simd::sinCos(th1[0], s1[0], c1[0]);
+                simd::sinCos(d[0], sd[0], cd[0]);
+            }
+            else
+            {
+                sinCos(th1, s1, c1, n);
+                sinCos(d, sd, cd, n);
+            }
+            s2d[n] = T(2) * product(sd, cd, n);
+            c2d[n] = product(cd, cd, n) - product(sd, sd, n);
+            sTh1Minus2Th2[n] = product(s2d, c1, n) - product(c2d, s1, n);
+            w1sq[n] = product(w1, w1, n);
+            w2sq[n] = product(w2, w2, n);
+            den[n] = -(k.m2 * c2d[n]);
+            if (n == 0) den[0] += k.twoM1PlusM2;
+            inner[n] = k.l2 * w2sq[n] + k.l1 * product(w1sq, cd, n);
+            num1[n] = -(k.gTwoM1PlusM2 * s1[n]) - k.gM2 * sTh1Minus2Th2[n] - T(2) * k.m2 * product(sd, inner, n);
+            num3[n] = k.l1M1PlusM2 * w1sq[n] + k.gM1PlusM2 * c1[n] + k.l2M2 * product(w2sq, cd, n);
+            twoSdNum3[n] = T(2) * product(sd, num3, n);
+            q1[n] = quotient(num1, den, q1, n);
+            q2[n] = quotient(twoSdNum3, den, q2, n);
+
+            // y' = f(y): coefficient n + 1 of the state is coefficient n of f / (n + 1)
+            const T inv = T(1) / T(n + 1);
+            th1[n + 1] = w1[n] * inv;
+            th2[n + 1] = w2[n] * inv;
+            w1[n + 1] = q1[n] * k.invL1 * inv;
+            w2[n + 1] = q2[n] * k.invL2 * inv;
+        }
+    }
+
+    // step size for the series of order p just expanded at y: the last two
+    // terms, which bound the truncation error, must stay under the mixed
+    // tolerance, with Jorba & Zou's safety factor. Infinite when both vanish.
+    double stepSize(const T* y, int p) const
+    {
+        const double eps = atol + rtol * norm(y);
+        double rho = HUGE_VAL;
+        for (int n = p - 1; n <= p; n++)
+        {
+            double c = fmax(fmax(fabs((double)th1[n]), fabs((double)th2[n])),
+                fmax(fabs((double)w1[n]), fabs((double)w2[n])));
+            if (c > 0.0) rho = fmin(rho, simd::scalarPow(eps / c, 1.0 / n));
+        }
+        return rho * simd::scalarExp(-0.7 / (p - 1));
+    }
+
+    // the series at time offset h, by Horner's rule
+    void evaluate(T h, int p, T* out) const
+    {
+        T a = th1[p], b = th2[p], c = w1[p], e = w2[p];
+        for (int n = p - 1; n >= 0; n--)
+        {
+            a = a * h + th1[n];
+            b = b * h + th2[n];
+            c = c * h + w1[n];
+            e = e * h + w2[n];
+        }
+        out[0] = a; out[1] = b; out[2] = c; out[3] = e;
+    }
+
+    // advance y by `span` (either sign); the last step is cut to end exactly
+    // there. Returns the number of steps taken.
+    int advance(T* y, T span)
+    {
+        using std::fabs;
+        const double total = fabs((double)span);
+        const double hMin = total * MIN_STEP_FRACTION;
+        const T dir = span < T(0) ? T(-1) : T(1);
+        T covered = T(0);
+        int steps = 0;
+        while (true)
+        {
+            const int p = order(y);
+            expand(y, p);
+            double h = stepSize(y, p);
+            if (!(h >= hMin)) h = hMin;     // also catches NaN
+            const T left = span - covered;
+            const bool last = h >= fabs((double)left);
+            const T step = last ? left : dir * T(h);
+            evaluate(step, p, y);
+            steps++;
+            if (last) return steps;
+            covered += step;
+        }
+    }
+
+private:
+    // coefficient n of a * b
+    static T product(const T* a, const T* b, int n)
+    {
+        T r = a[0] * b[n];
+        for (int j = 1; j <= n; j++) r += a[j] * b[n - j];
+        return r;
+    }
+
+    // coefficient n of q = a / b, given q's coefficients below n
+    static T quotient(const T* a, const T* b, const T* q, int n)
+    {
+        T r = a[n];
+        for (int j = 1; j <= n; j++) r -= b[j] * q[n - j];
+        return r / b[0];
+    }
+
+    // coefficient n >= 1 of s = sin(x) and c = cos(x), from s' = c x', c' = -s x'
+    static void sinCos(const T* x, T* s, T* c, int n)
+    {
+        T rs = T(0), rc = T(0);
+        for (int j = 1; j <= n; j++)
+        {
+            T jx = T(j) * x[j];
+            rs += jx * c[n - j];
+            rc += jx * s[n - j];
+        }
+        const T inv = T(1) / T(n);
+        s[n] = rs * inv;
+        c[n] = -(rc * inv);
+    }
+
+    static double norm(const T* y)
+    {
+        return fmax(fmax(fabs((double)y[0]), fabs((double)y[1])), fmax(fabs((double)y[2]), fabs((double)y[3])));
+    }
+
+    // series of the state and of every intermediate term, index n holding the
+    // coefficient of h^n
+    T th1[MAX_ORDER + 1], th2[MAX_ORDER + 1], w1[MAX_ORDER + 1], w2[MAX_ORDER + 1];
+    T d[MAX_ORDER + 1], s1[MAX_ORDER + 1], c1[MAX_ORDER + 1], sd[MAX_ORDER + 1], cd[MAX_ORDER + 1];
+    T s2d[MAX_ORDER + 1], c2d[MAX_ORDER + 1], sTh1Minus2Th2[MAX_ORDER + 1];
+    T w1sq[MAX_ORDER + 1], w2sq[MAX_ORDER + 1], den[MAX_ORDER + 1], inner[MAX_ORDER + 1];
+    T num1[MAX_ORDER + 1], num3[MAX_ORDER + 1], twoSdNum3[MAX_ORDER + 1];
+    T q1[MAX_ORDER + 1], q2[MAX_ORDER + 1];
+};
@@ -0,0 +1,228 @@
+﻿#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// -------- fork/join thread pool with work stealing --------
+// parallelFor() cuts [0, count) into chunks and deals each worker a contiguous
+// run of them. A worker takes chunks from the front of its own run and, once it
+// is empty, steals the back half of another worker's run, so uneven chunks
+// (e.g. members that retire early) still balance. The calling thread takes
+// part as worker 0, so a pool of size 1 runs everything inline.
+class ThreadPool
+{
+public:
+    explicit ThreadPool(int threads = 0)
+    {
+        resize(threads);
+    }
+
+    ~ThreadPool()
+    {
+        stopWorkers();
+    }
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    static int hardwareThreads()
+    {
+        unsigned n = std::thread::hardware_concurrency();
+        return n ? (int)n : 1;
+    }
+
+    // threads <= 0 picks one per hardware thread
+    void resize(int threads)
+    {
+        if (threads <= 0) threads = hardwareThreads();
+        if (threads == size()) return;
+
+        stopWorkers();
+        ranges.reset(new Range[threads]);
+        workerCount = threads;
+        // new workers start at the current generation, or they would take
+        // the last job, long finished, for a new one
+        uint64_t current;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = false;
+            busyWorkers = 0;
+            current = generation;
+        }
+        for (int w = 1; w < threads; w++)
+            workers.emplace_back([this, w, current] { workerLoop(w, current); });
+    }
+
+    int size() const { return workerCount; }
+
+    // fn(begin, end) over [0, count) in chunks of `grain`, returns when all are done.
+    // The chunk boundaries depend only on count and grain, never on the number
+    // of threads, so per-chunk partial results combine the same way everywhere.
+    template <typename F>
+    void parallelFor(int count, int grain, F&& fn)
+    {
+        if (count <= 0) return;
+        if (grain < 1) grain = 1;
+        int chunks = (count + grain - 1) / grain;
+
+        if (workerCount == 1 || chunks == 1)
+        {
+            for (int begin = 0; begin < count; begin += grain)
+                fn(begin, begin + grain < count ? begin + grain : count);
+            return;
+        }
+
+        struct Job
+        {
+            F* fn;
+            int count, grain;
+            static void run(void* self, int chunk)
+            {
+                Job* job = (Job*)self;
+                int begin = chunk * job->grain;
+                int end = begin + job->grain < job->count ? begin + job->grain : job->count;
+                (*job->fn)(begin, end);
+            }
+        } job{ &fn, count, grain };
+
+        // deal contiguous runs of chunks
+        for (int w = 0; w < workerCount; w++)
+        {
+            uint32_t b = (uint32_t)((int64_t)chunks * w / workerCount);
+            uint32_t e = (uint32_t)((int64_t)chunks * (w + 1) / workerCount);
+            ranges[w].bounds.store(pack(b, e), std::memory_order_relaxed);
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            task = &Job::run;
+            taskData = &job;
+            remaining.store(chunks, std::memory_order_relaxed);
+            busyWorkers = workerCount - 1;
+            generation++;
+        }
+        wake.notify_all();
+
+        runChunks(0);
+
+        // the job lives on this stack frame: wait for every worker to let go of it
+        std::unique_lock<std::mutex> lock(mutex);
+        done.wait(lock, [this] { return busyWorkers == 0; });
+        task = nullptr;
+        taskData = nullptr;
+    }
+
+private:
+    // [begin, end) of chunk indices packed in one word so owner and thieves can CAS it
+    struct alignas(64) Range
+    {
+        std::atomic<uint64_t> bounds{ 0 };
+    };
+
+    static uint64_t pack(uint32_t b, uint32_t e) { return ((uint64_t)e << 32) | b; }
+    static uint32_t lo(uint64_t r) { return (uint32_t)r; }
+    static uint32_t hi(uint64_t r) { return (uint32_t)(r >> 32); }
+
+    // take the next chunk from the front of our own run
+    bool popOwn(int w, uint32_t& chunk)
+    {
+        std::atomic<uint64_t>& r = ranges[w].bounds;
+        uint64_t cur = r.load(std::memory_order_acquire);
+        while (lo(cur) < hi(cur))
+        {
+            if (r.compare_exchange_weak(cur, pack(lo(cur) + 1, hi(cur)), std::memory_order_acq_rel))
+            {
+                chunk = lo(cur);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // move the back half of some other worker's run into ours
+    bool steal(int w)
+    {
+        for (int k = 1; k < workerCount; k++)
+        {
+            int victim = (w + k) % workerCount;
+            std::atomic<uint64_t>& r = ranges[victim].bounds;
+            uint64_t cur = r.load(std::memory_order_acquire);
+            while (lo(cur) < hi(cur))
+            {
+                uint32_t left = hi(cur) - lo(cur);
+                uint32_t split = hi(cur) - (left + 1) / 2;
+                if (r.compare_exchange_weak(cur, pack(lo(cur), split), std::memory_order_acq_rel))
+                {
+                    ranges[w].bounds.store(pack(split, hi(cur)), std::memory_order_release);
+                    return true;
+                }
+            }
+        }
+        return false;
+    }
+
+    void runChunks(int w)
+    {
+        uint32_t chunk;
+        for (;;)
+        {
+            if (popOwn(w, chunk))
+            {
+                task(taskData, (int)chunk);
+                remaining.fetch_sub(1, std::memory_order_acq_rel);
+                continue;
+            }
+            if (remaining.load(std::memory_order_acquire) == 0) return;
+            if (!steal(w)) std::this_thread::yield();
+        }
+    }
+
+    void workerLoop(int w, uint64_t seen)
+    {
+        for (;;)
+        {
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                wake.wait(lock, [&] { return stopping || generation != seen; });
+                if (stopping) return;
+                seen = generation;
+            }
+
+            runChunks(w);
+
+            std::lock_guard<std::mutex> lock(mutex);
+            if (--busyWorkers == 0) done.notify_one();
+        }
+    }
+
+    void stopWorkers()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (auto& t : workers) t.join();
+        workers.clear();
+        workerCount = 1;
+    }
+
+    std::vector<std::thread> workers;
+    std::unique_ptr<Range[]> ranges;
+    int workerCount = 1;
+
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable done;
+    bool stopping = false;
+    uint64_t generation = 0;
+    int busyWorkers = 0;
+
+    void (*task)(void*, int) = nullptr;
+    void* taskData = nullptr;
+    std::atomic<int> remaining{ 0 };
+};
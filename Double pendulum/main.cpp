@@ -1,6 +1,22 @@
 ﻿#include <GLFW/glfw3.h>
 #include <vector>
-#include "Pendulum.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include "PendulumEnsemble.h"
+#include "ChainEnsemble.h"
+#include "FixedTimestep.h"
+#include "Checkpoint.h"
+#include "Determinism.h"
+#include "Fractal.h"
+#include "Quadtree.h"
+#include "Ftle.h"
+#include "Poincare.h"
+#include "Parareal.h"
+#include "Sweep.h"
+#include "InitialConditions.h"
 #include "imgui.h"
 #include "imgui_impl_glfw.h"
 #include "imgui_impl_opengl2.h"
@@ -24,24 +40,549 @@ float g_l2 = 100.0f;
 float g_m1 = 30.0f;
 float g_m2 = 10.0f;
 float g_gravity = -9.81f;
+float g_rtol = 1e-5f;
+float g_atol = 1e-6f;
 
 int g_count = 250;
+int g_links = 2;
+float g_timeStep = 0.01f;
+float g_timeScale = 3.0f;
+int g_integrator = (int)Integrator::RK4;
+int g_precision = (int)Precision::Float;
+int g_threads = 0;
+int g_eventMask = 0;
+int g_retireMask = 0;
+bool g_energyMonitor = false;
+int g_energyInterval = PendulumEnsemble<float>::DEFAULT_ENERGY_INTERVAL;
+float g_energyThreshold = 1e-3f;
+bool g_lyapunov = false;
+int g_lyapunovInterval = PendulumEnsemble<float>::DEFAULT_LYAPUNOV_INTERVAL;
+unsigned long long g_eventTotal = 0;
+unsigned long long g_eventCounts[(int)EventKind::Count] = {};
+unsigned long long g_eventDropped = 0;  // events lost to a full buffer, not in the counts
+unsigned long long g_seed = 0;      // seed of the random initial conditions
+int g_generator = (int)initial::Generator::Ramp;
+float g_spread[4] = { 0.1f, 0.1f, 0.0f, 0.0f };    // theta1, theta2, omega1, omega2 around the initial state
+char g_checkpointPath[256] = "pendulum.dpck";
+const char* g_restorePath = nullptr;
+float g_autosave = 0.0f;            // seconds between checkpoints, 0 = off
+bool g_checkDeterminism = false;
+const char* g_fractalPath = nullptr;    // --fractal: write the flip-time map and exit
+int g_fractalSize = 1024;
+float g_fractalTime = 100.0f;
+bool g_fractalAdaptive = false;     // --fractal-adaptive: quadtree refinement instead of every pixel
+const char* g_ftlePath = nullptr;       // --ftle: write the FTLE field and exit
+ftle::Settings g_ftle;
+float g_ftleMax = 2.0f;                 // FTLE shown as white in the PGM
+parareal::Settings g_parareal;
+bool g_pararealRun = false;             // --parareal: one trajectory parallel in time, then exit
+int g_flipMapSize = 512;
+float g_flipMapTime = 30.0f;
+bool g_flipMapRunning = false;
+int g_sectionVariable = -1;             // Poincare section, -1 = off
+float g_sectionValue = 0.0f;            // angles measured from hanging
+int g_sectionDirection = 1;             // +1 increasing, -1 decreasing, 0 both
+int g_sectionPlotX = 1;                 // variables on the scatter plot's axes
+int g_sectionPlotY = 3;
+float g_sectionRateRange = 5.0f;        // rates shown on the plot
+int g_sectionPlotSize = 512;
+char g_sectionPath[256] = "section.bin";
+unsigned long long g_sectionTotal = 0;
+unsigned long long g_sectionDropped = 0;
+float g_sectionRate = 0.0f;             // points per second of wall time
+sweep::Settings g_sweep;                // one parameter spread over the members
 
-std::vector<Pendulum> pendulums;
+AnyEnsemble pendulums;
+ChainEnsemble chains;
+ThreadPool pool(1);
+FixedTimestep simClock;
+SnapshotChannel<SimParams> paramsChannel;
+checkpoint::AsyncSaver saver;
+QuadtreeMap flipMap;                // the "Flip-time map" window
+fractal::Settings flipMapSettings;
+SimParams flipMapParams;            // snapshot taken when the render started
+GLuint flipMapTexture = 0;
+poincare::SectionHistogram sectionPlot;    // the "Poincare section" window
+poincare::SectionStream sectionStream;
+GLuint sectionTexture = 0;
 
+// copy the UI controls into this frame's parameter snapshot
+static SimParams currentParams()
+{
+    SimParams p;
+    p.l1 = g_l1; p.l2 = g_l2;
+    p.m1 = g_m1; p.m2 = g_m2;
+    p.gravity = g_gravity;
+    p.rtol = g_rtol; p.atol = g_atol;
+    return p;
+}
+
+// the section as the ensembles take it: angles absolute, not from hanging
+static PoincareSection currentSection()
+{
+    PoincareSection s;
+    s.variable = g_sectionVariable;
+    s.value = g_sectionValue;
+    if (g_sectionVariable == 0 || g_sectionVariable == 1)
+        s.value += g_gravity < 0.0f ? PI : 0.0;
+    s.direction = g_sectionDirection;
+    return s;
+}
+
+// more than two links switches from the double pendulum ensemble to chains
+static bool useChains() { return g_links > 2; }
+
+// the initial conditions the UI describes; a sweep starts every member from
+// the same state, so only its parameters differ
+static initial::Settings currentInitial()
+{
+    initial::Settings s;
+    s.generator = (initial::Generator)g_generator;
+    s.seed = g_seed;
+    s.center[0] = g_theta1; s.center[1] = g_theta2;
+    for (int d = 0; d < 4; d++) s.spread[d] = g_spread[d];
+    s.step = g_thetaOffset;
+    if (g_sweep.active() && !useChains())
+    {
+        s.generator = initial::Generator::Ramp;
+        s.step = 0.0f;
+    }
+    return s;
+}
+
+// members are generated in parallel, each from (seed, index) alone
 static void initPendulums(int count)
 {
-    pendulums.clear();
+    const initial::Settings init = currentInitial();
+    if (useChains())
+    {
+        // chains take the angles and start at rest
+        chains.resize(count, g_links);
+        pool.parallelFor(count, PendulumEnsemble<float>::CHUNK, [&](int begin, int end) {
+            for (int i = begin; i < end; i++)
+            {
+                double y[4];
+                init.state(i, y);
+                chains.set(i, (float)y[0], (float)y[1], i * g_hueOffset);
+            }
+            });
+        pendulums.resize(0);
+        return;
+    }
+    chains.resize(0, 1);
 
-    for (int i = 0; i < count; i++)
+    pendulums.resize(count);
+    pendulums.setAll(pool, [&](int i, double* y, float& hue) {
+        init.state(i, y);
+        hue = i * g_hueOffset;
+        });
+    if (g_sweep.active())
     {
-        Pendulum p(g_theta1, g_theta2 + i * g_thetaOffset, i * g_hueOffset);
-        pendulums.push_back(p);
+        const SimParams base = currentParams();
+        for (int i = 0; i < count; i++)
+            pendulums.setParams(i, g_sweep.member(base, i, count));
     }
 }
 
-int main()
+// Everything a checkpoint holds, in file order: the settings, then both
+// ensembles. The thread count is left out, it belongs to the machine.
+template <typename A>
+static void serializeState(A& ar)
+{
+    ar.io(g_pause); ar.io(g_reverse);
+    ar.io(g_showPendulums); ar.io(g_showTrails);
+    ar.io(g_thetaOffset); ar.io(g_hueOffset);
+    ar.io(g_theta1); ar.io(g_theta2);
+    ar.io(g_l1); ar.io(g_l2);
+    ar.io(g_m1); ar.io(g_m2);
+    ar.io(g_gravity);
+    ar.io(g_rtol); ar.io(g_atol);
+    ar.io(g_count); ar.io(g_links);
+    ar.io(g_timeStep); ar.io(g_timeScale);
+    ar.io(g_integrator);
+    ar.io(g_eventMask); ar.io(g_retireMask);
+    ar.io(g_energyMonitor); ar.io(g_energyInterval); ar.io(g_energyThreshold);
+    ar.io(g_eventTotal);
+    ar.array(g_eventCounts, (int)EventKind::Count);
+    ar.io(g_seed);
+    if (ar.version >= 2)
+    {
+        ar.io(g_lyapunov); ar.io(g_lyapunovInterval);
+    }
+    if (ar.version >= 3)
+    {
+        ar.io(g_sectionVariable); ar.io(g_sectionValue); ar.io(g_sectionDirection);
+        ar.io(g_sectionPlotX); ar.io(g_sectionPlotY); ar.io(g_sectionRateRange);
+    }
+    if (ar.version >= 5)
+    {
+        ar.io(g_sweep.parameter); ar.io(g_sweep.from); ar.io(g_sweep.to); ar.io(g_sweep.logarithmic);
+    }
+    if (ar.version >= 6)
+    {
+        ar.io(g_generator);
+        ar.array(g_spread, 4);
+    }
+    if (ar.version >= 8)
+        ar.io(g_eventDropped);
+    if constexpr (A::reading)
+        ar.check(g_count >= 1 && g_links >= 2 && g_links <= ChainEnsemble::MAX_LINKS
+            && g_integrator >= 0 && g_integrator < (int)Integrator::Count && g_lyapunovInterval >= 1
+            && g_sectionVariable >= -1 && g_sectionVariable < 4 && g_sectionDirection >= -1 && g_sectionDirection <= 1
+            && g_sectionPlotX >= 0 && g_sectionPlotX < 4 && g_sectionPlotY >= 0 && g_sectionPlotY < 4
+            && (int)g_sweep.parameter >= 0 && g_sweep.parameter < sweep::Parameter::Count
+            && g_generator >= 0 && g_generator < (int)initial::Generator::Count);
+    pendulums.serialize(ar);
+    chains.serialize(ar);
+    g_precision = (int)pendulums.precision();
+}
+
+static bool saveCheckpoint()
+{
+    return saver.save(g_checkpointPath, [](auto& ar) { serializeState(ar); });
+}
+
+// a file that fails to load leaves the current state as it was
+static bool loadCheckpoint(const char* path)
+{
+    checkpoint::MemorySink backup;
+    checkpoint::Writer<checkpoint::MemorySink> out(backup);
+    serializeState(out);
+
+    if (checkpoint::load(path, [](auto& ar) { serializeState(ar); }))
+        return true;
+    checkpoint::Reader in(backup.bytes.data(), backup.bytes.size());
+    serializeState(in);
+    return false;
+}
+
+// "theta1", "omega2", "m2/m1", ... as named by ftle::axisName()
+static bool parseAxis(const std::string& name, ftle::Axis& axis)
+{
+    for (int a = 0; a < (int)ftle::Axis::Count; a++)
+        if (name == ftle::axisName((ftle::Axis)a))
+        {
+            axis = (ftle::Axis)a;
+            return true;
+        }
+    return false;
+}
+
+static void parseArgs(int argc, char** argv)
+{
+    bool xRange = false, yRange = false;
+    for (int i = 1; i < argc; i++)
+    {
+        if (!strcmp(argv[i], "--threads") && i + 1 < argc)
+            g_threads = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--links") && i + 1 < argc)
+            g_links = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--checkpoint") && i + 1 < argc)
+            snprintf(g_checkpointPath, sizeof(g_checkpointPath), "%s", argv[++i]);
+        else if (!strcmp(argv[i], "--restore") && i + 1 < argc)
+            g_restorePath = argv[++i];
+        else if (!strcmp(argv[i], "--autosave") && i + 1 < argc)
+            g_autosave = (float)atof(argv[++i]);
+        else if (!strcmp(argv[i], "--check-determinism"))
+            g_checkDeterminism = true;
+        else if (!strcmp(argv[i], "--fractal") && i + 1 < argc)
+            g_fractalPath = argv[++i];
+        else if (!strcmp(argv[i], "--fractal-size") && i + 1 < argc)
+            g_fractalSize = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--fractal-time") && i + 1 < argc)
+            g_fractalTime = (float)atof(argv[++i]);
+        else if (!strcmp(argv[i], "--fractal-adaptive"))
+            g_fractalAdaptive = true;
+        else if (!strcmp(argv[i], "--ftle") && i + 1 < argc)
+            g_ftlePath = argv[++i];
+        else if (!strcmp(argv[i], "--ftle-size") && i + 1 < argc)
+            g_ftle.width = g_ftle.height = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--ftle-time") && i + 1 < argc)
+            g_ftle.time = (float)atof(argv[++i]);
+        else if (!strcmp(argv[i], "--ftle-max") && i + 1 < argc)
+            g_ftleMax = (float)atof(argv[++i]);
+        else if (!strcmp(argv[i], "--ftle-axes") && i + 1 < argc)
+        {
+            std::string axes = argv[++i];
+            size_t comma = axes.find(',');
+            if (comma == std::string::npos || !parseAxis(axes.substr(0, comma), g_ftle.xAxis)
+                || !parseAxis(axes.substr(comma + 1), g_ftle.yAxis))
+                fprintf(stderr, "Unknown --ftle-axes %s\n", axes.c_str());
+        }
+        else if (!strcmp(argv[i], "--ftle-x") && i + 2 < argc)
+        {
+            g_ftle.xMin = atof(argv[++i]);
+            g_ftle.xMax = atof(argv[++i]);
+            xRange = true;
+        }
+        else if (!strcmp(argv[i], "--ftle-y") && i + 2 < argc)
+        {
+            g_ftle.yMin = atof(argv[++i]);
+            g_ftle.yMax = atof(argv[++i]);
+            yRange = true;
+        }
+        else if (!strcmp(argv[i], "--ftle-base") && i + 4 < argc)
+            for (double& v : g_ftle.base) v = atof(argv[++i]);
+        else if (!strcmp(argv[i], "--parareal") && i + 1 < argc)
+        {
+            g_parareal.steps = atoll(argv[++i]);
+            g_pararealRun = true;
+        }
+        else if (!strcmp(argv[i], "--parareal-window") && i + 1 < argc)
+            g_parareal.window = atoll(argv[++i]);
+        else if (!strcmp(argv[i], "--parareal-slices") && i + 1 < argc)
+            g_parareal.slices = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--parareal-coarse") && i + 1 < argc)
+            g_parareal.coarseRatio = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--parareal-tol") && i + 1 < argc)
+            g_parareal.tolerance = atof(argv[++i]);
+        else if (!strcmp(argv[i], "--init") && i + 1 < argc)
+        {
+            const char* name = argv[++i];
+            bool known = false;
+            for (int g = 0; g < (int)initial::Generator::Count; g++)
+                if (!strcmp(name, initial::generatorName((initial::Generator)g)))
+                {
+                    g_generator = g;
+                    known = true;
+                }
+            if (!known)
+                fprintf(stderr, "Unknown --init %s\n", name);
+        }
+        else if (!strcmp(argv[i], "--init-spread") && i + 4 < argc)
+        {
+            for (int d = 0; d < 4; d++)
+                g_spread[d] = (float)atof(argv[++i]);
+        }
+        else if (!strcmp(argv[i], "--seed") && i + 1 < argc)
+            g_seed = strtoull(argv[++i], nullptr, 0);
+        else if (!strcmp(argv[i], "--precision") && i + 1 < argc)
+        {
+            // "long-double" is accepted for "long double"
+            std::string name = argv[++i];
+            std::string spaced = name;
+            for (char& c : spaced) if (c == '-') c = ' ';
+            bool known = false;
+            for (int p = 0; p < (int)Precision::Count; p++)
+                if (name == precisionName((Precision)p) || spaced == precisionName((Precision)p))
+                {
+                    g_precision = p;
+                    known = true;
+                }
+            if (!known)
+                fprintf(stderr, "Unknown --precision %s\n", name.c_str());
+        }
+    }
+    if (!xRange) ftle::defaultRange(g_ftle.xAxis, g_ftle.xMin, g_ftle.xMax);
+    if (!yRange) ftle::defaultRange(g_ftle.yAxis, g_ftle.yMin, g_ftle.yMax);
+}
+
+// headless: the flip-time map of the current (or restored) parameters to PATH.pgm and PATH.f32
+static int renderFractal()
+{
+    fractal::Settings s;
+    s.width = s.height = g_fractalSize > 0 ? g_fractalSize : 1;
+    s.dt = g_timeStep;
+    s.maxTime = g_fractalTime;
+
+    const SimParams params = currentParams();
+    auto start = std::chrono::steady_clock::now();
+    std::vector<float> map;
+    if (g_fractalAdaptive)
+    {
+        QuadtreeMap q;
+        q.reset(s.width, s.height);
+        while (q.advance(pool, 1 << 16,
+            [&](const int* pixels, int n, float* values) { fractal::flipTimes(params, s, pixels, n, values); },
+            [&](float t) { return fractal::bucket(t, s.maxTime); }))
+            fprintf(stderr, "\rfractal: cells of %d, %.1f%% of the pixels sampled", q.cellSize(),
+                100.0 * q.sampled() / q.values().size());
+        map = q.values();
+    }
+    else
+        map = fractal::render(params, s, pool, [](int done, int total) {
+            fprintf(stderr, "\rfractal: %d/%d rows of tiles", done, total);
+            });
+    std::chrono::duration<double> took = std::chrono::steady_clock::now() - start;
+    size_t flipped = 0;
+    for (float t : map) flipped += t >= 0.0f;
+    fprintf(stderr, "\n%dx%d, %.1f%% flip within %.0f s, %.1f s on %d threads\n", s.width, s.height,
+        100.0 * flipped / map.size(), s.maxTime, took.count(), pool.size());
+
+    std::string base = g_fractalPath;
+    bool ok = fractal::writePGM((base + ".pgm").c_str(), map, s);
+    ok = fractal::writeRaw((base + ".f32").c_str(), map) && ok;
+    if (!ok) fprintf(stderr, "Could not write %s.pgm / %s.f32\n", g_fractalPath, g_fractalPath);
+    return ok ? 0 : 1;
+}
+
+// headless: the FTLE field of the current (or restored) parameters to
+// PATH.f32 and PATH.pgm, streamed a band of tiles at a time
+static int renderFtle()
+{
+    ftle::Settings& s = g_ftle;
+    if (s.width < 1) s.width = s.height = 1;
+    s.dt = g_timeStep;
+    ftle::Output out;
+    if (!out.open(g_ftlePath, s.width, s.height, g_ftleMax))
+    {
+        fprintf(stderr, "Could not create %s.f32 / %s.pgm\n", g_ftlePath, g_ftlePath);
+        return 1;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    ftle::render(currentParams(), s, pool, [&](const float* values, int y0, int rows) {
+        out.write(values, rows);
+        fprintf(stderr, "\rftle: %d/%d rows", y0 + rows, s.height);
+        });
+    std::chrono::duration<double> took = std::chrono::steady_clock::now() - start;
+    fprintf(stderr, "\n%dx%d, %s by %s over %.1f s, %.1f s on %d threads\n", s.width, s.height,
+        ftle::axisName(s.xAxis), ftle::axisName(s.yAxis), s.time, took.count(), pool.size());
+    if (!out.close())
+    {
+        fprintf(stderr, "Could not write %s.f32 / %s.pgm\n", g_ftlePath, g_ftlePath);
+        return 1;
+    }
+    return 0;
+}
+
+// headless: the first member's trajectory by Parareal, then serially to check
+// it; fails like --check-determinism when the two disagree by more than the
+// tolerance (at all, with tolerance 0)
+template <typename T>
+static int runParareal()
+{
+    parareal::Settings& s = g_parareal;
+    s.dt = g_timeStep;
+    if (s.steps < 1) s.steps = 1;
+    if (s.coarseRatio < 1) s.coarseRatio = 1;
+    const SimParams params = currentParams();
+    double first[4];
+    currentInitial().state(0, first);
+    const T start[4] = { T(first[0]), T(first[1]), T(first[2]), T(first[3]) };
+
+    T y[4] = { start[0], start[1], start[2], start[3] };
+    auto t0 = std::chrono::steady_clock::now();
+    parareal::Report r = parareal::run(params, s, y, pool);
+    std::chrono::duration<double> parallel = std::chrono::steady_clock::now() - t0;
+
+    T z[4] = { start[0], start[1], start[2], start[3] };
+    t0 = std::chrono::steady_clock::now();
+    parareal::serial(params, s, z);
+    std::chrono::duration<double> serial = std::chrono::steady_clock::now() - t0;
+
+    double diff = 0.0;
+    bool same = true;
+    for (int j = 0; j < 4; j++)
+    {
+        diff = fmax(diff, fabs((double)(y[j] - z[j])));
+        same = same && y[j] == z[j];
+    }
+    printf("%lld steps of %g s in %s, %d windows of %d slices, %d iterations (%d windows exact)\n",
+        s.steps, s.dt, precisionName((Precision)g_precision), r.windows, s.slices, r.iterations, r.exactWindows);
+    printf("state %.17g %.17g %.17g %.17g\n", (double)y[0], (double)y[1], (double)y[2], (double)y[3]);
+    printf("parareal %.2f s on %d threads, serial %.2f s, speedup %.2f\n",
+        parallel.count(), pool.size(), serial.count(), serial.count() / parallel.count());
+    printf("serial check: %s (max difference %.3g)\n", same ? "identical" : "differs", diff);
+    return (s.tolerance > 0.0 ? diff <= s.tolerance : same) ? 0 : 1;
+}
+
+static void startFlipMap()
+{
+    flipMapSettings.width = flipMapSettings.height = g_flipMapSize;
+    flipMapSettings.dt = g_timeStep;
+    flipMapSettings.maxTime = g_flipMapTime;
+    flipMapParams = currentParams();
+    flipMap.reset(g_flipMapSize, g_flipMapSize);
+    g_flipMapRunning = true;
+}
+
+// an 8-bit grey image into `texture`, created on first use
+static void uploadGray(GLuint& texture, int width, int height, const unsigned char* pixels)
+{
+    if (!texture) glGenTextures(1, &texture);
+    glBindTexture(GL_TEXTURE_2D, texture);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_LUMINANCE, width, height, 0, GL_LUMINANCE, GL_UNSIGNED_BYTE, pixels);
+    glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+// refine the flip-time map for about `seconds` of this frame, then show it
+static void refineFlipMap(double seconds)
+{
+    const double start = glfwGetTime();
+    do
+    {
+        g_flipMapRunning = flipMap.advance(pool, 256 * pool.size(),
+            [](const int* pixels, int n, float* values) {
+                fractal::flipTimes(flipMapParams, flipMapSettings, pixels, n, values);
+            },
+            [](float t) { return fractal::bucket(t, flipMapSettings.maxTime); });
+    } while (g_flipMapRunning && glfwGetTime() - start < seconds);
+
+    std::vector<unsigned char> pixels(flipMap.values().size());
+    for (size_t i = 0; i < pixels.size(); i++)
+        pixels[i] = (unsigned char)(255.0 * fractal::shade(flipMap.values()[i], flipMapSettings.maxTime) + 0.5);
+    uploadGray(flipMapTexture, flipMap.mapWidth(), flipMap.mapHeight(), pixels.data());
+}
+
+// start the scatter plot over, for new axes or a new section
+static void resetSectionPlot()
+{
+    sectionPlot.xVariable = g_sectionPlotX;
+    sectionPlot.yVariable = g_sectionPlotY;
+    sectionPlot.hanging = g_gravity < 0.0f ? PI : 0.0;
+    sectionPlot.rateRange = g_sectionRateRange;
+    sectionPlot.reset(g_sectionPlotSize);
+}
+
+// hand this frame's crossings to the plot and the recording, then free the buffer
+static void drainSection()
+{
+    const AppendBuffer<SectionPoint>& points = pendulums.sectionPoints();
+    sectionPlot.add(points.data(), points.size());
+    sectionStream.write(points.data(), points.size());
+    g_sectionTotal += points.size();
+    g_sectionDropped += points.dropped();
+    pendulums.clearSectionPoints();
+}
+
+int main(int argc, char** argv)
 {
+    parseArgs(argc, argv);
+    if (g_checkDeterminism)
+        return determinism::check(stdout) ? 0 : 1;
+    if (g_links < 2) g_links = 2;
+    if (g_links > ChainEnsemble::MAX_LINKS) g_links = ChainEnsemble::MAX_LINKS;
+    pool.resize(g_threads);
+    g_threads = pool.size();
+    pendulums.setPrecision((Precision)g_precision);
+
+    bool restored = false;
+    if (g_restorePath)
+    {
+        restored = loadCheckpoint(g_restorePath);
+        if (!restored)
+            fprintf(stderr, "Could not restore %s, starting from scratch\n", g_restorePath);
+    }
+    if (g_fractalPath)
+        return renderFractal();
+    if (g_ftlePath)
+        return renderFtle();
+    if (g_pararealRun)
+    {
+        if (g_parareal.slices < 1) g_parareal.slices = pool.size();
+        switch ((Precision)g_precision)
+        {
+        case Precision::Float: return runParareal<float>();
+        case Precision::LongDouble: return runParareal<long double>();
+        case Precision::DoubleDouble: return runParareal<DoubleDouble>();
+        default: return runParareal<double>();
+        }
+    }
+
     glfwInit();
     GLFWwindow* window = glfwCreateWindow(WIDTH, HEIGHT, "Double Pendulum", nullptr, nullptr);
     glfwMakeContextCurrent(window);
@@ -64,7 +605,14 @@ int main()
     ImGui_ImplOpenGL2_Init();
     ImGui::StyleColorsDark();
 
-    initPendulums(g_count);
+    if (!restored)
+        initPendulums(g_count);
+    double lastSave = glfwGetTime();
+    const char* checkpointStatus = restored ? "Restored" : "";
+    const char* sectionStatus = "";
+    resetSectionPlot();
+    double rateStart = glfwGetTime();
+    unsigned long long rateTotal = 0;
 
     while (!glfwWindowShouldClose(window))
     {
@@ -84,8 +632,76 @@ int main()
 
 		ImGui::Separator();
 
-        if (ImGui::SliderFloat("Angle offset", &g_thetaOffset, 0.0001, 0.5)) {
-			initPendulums(g_count);
+        if (ImGui::BeginCombo("Integrator", integratorName((Integrator)g_integrator)))
+        {
+            // the Lyapunov tangents cannot ride along with the adaptive methods
+            for (int m = 0; m < (int)Integrator::Count; m++)
+                if (ImGui::Selectable(integratorName((Integrator)m), m == g_integrator,
+                    g_lyapunov && !lyapunov::supports((Integrator)m) ? ImGuiSelectableFlags_Disabled : 0))
+                    g_integrator = m;
+            ImGui::EndCombo();
+        }
+        if (ImGui::BeginCombo("Precision", precisionName((Precision)g_precision)))
+        {
+            for (int p = 0; p < (int)Precision::Count; p++)
+                if (ImGui::Selectable(precisionName((Precision)p), p == g_precision))
+                {
+                    g_precision = p;
+                    pendulums.setPrecision((Precision)p);
+                    initPendulums(g_count);
+                }
+            ImGui::EndCombo();
+        }
+        ImGui::SliderFloat("Time step", &g_timeStep, 0.001f, 0.1f, "%.4f", ImGuiSliderFlags_Logarithmic);
+        ImGui::SliderFloat("Time scale", &g_timeScale, 0.0f, 10.0f);
+        if (g_integrator == (int)Integrator::DormandPrince45)
+        {
+            ImGui::SliderFloat("Rel. tolerance", &g_rtol, 1e-7f, 1e-2f, "%.1e", ImGuiSliderFlags_Logarithmic);
+            ImGui::SliderFloat("Abs. tolerance", &g_atol, 1e-8f, 1e-2f, "%.1e", ImGuiSliderFlags_Logarithmic);
+        }
+        if (g_integrator == (int)Integrator::Taylor)
+        {
+            // the order follows the tolerance, so it can go down to rounding
+            ImGui::SliderFloat("Rel. tolerance", &g_rtol, 1e-16f, 1e-2f, "%.1e", ImGuiSliderFlags_Logarithmic);
+            ImGui::SliderFloat("Abs. tolerance", &g_atol, 1e-16f, 1e-2f, "%.1e", ImGuiSliderFlags_Logarithmic);
+            ImGui::Text("mean step %.3g s", pendulums.meanTaylorStep());
+        }
+
+		ImGui::Separator();
+
+        if (ImGui::BeginCombo("Initial conditions", initial::generatorName((initial::Generator)g_generator)))
+        {
+            for (int g = 0; g < (int)initial::Generator::Count; g++)
+                if (ImGui::Selectable(initial::generatorName((initial::Generator)g), g == g_generator))
+                {
+                    g_generator = g;
+                    initPendulums(g_count);
+                }
+            ImGui::EndCombo();
+        }
+        if (g_generator == (int)initial::Generator::Ramp)
+        {
+            if (ImGui::SliderFloat("Angle offset", &g_thetaOffset, 0.0001, 0.5)) {
+                initPendulums(g_count);
+            }
+        }
+        else
+        {
+            // box half-widths, or standard deviations for the Gaussian
+            bool changed = false;
+            changed |= ImGui::SliderAngle("Spread O1", &g_spread[0], 0.0f, 180.0f);
+            changed |= ImGui::SliderAngle("Spread O2", &g_spread[1], 0.0f, 180.0f);
+            changed |= ImGui::SliderFloat("Spread W1", &g_spread[2], 0.0f, 10.0f);
+            changed |= ImGui::SliderFloat("Spread W2", &g_spread[3], 0.0f, 10.0f);
+            changed |= ImGui::InputScalar("Seed", ImGuiDataType_U64, &g_seed);
+            ImGui::SameLine();
+            if (ImGui::Button("New"))
+            {
+                g_seed = (unsigned long long)std::chrono::steady_clock::now().time_since_epoch().count();
+                changed = true;
+            }
+            if (changed)
+                initPendulums(g_count);
         }
         if (ImGui::SliderFloat("Hue offset", &g_hueOffset, 0.0001, 0.1)) {
 			initPendulums(g_count);
@@ -96,31 +712,337 @@ int main()
         if (ImGui::SliderAngle("Initial O2", &g_theta2, -180.0, 180.0)) {
 			initPendulums(g_count);
         }
-        ImGui::SliderFloat("L1", &g_l1, 20, 300);
-        ImGui::SliderFloat("L2", &g_l2, 20, 300);
-        ImGui::SliderFloat("M1", &g_m1, 1, 100);
-        ImGui::SliderFloat("M2", &g_m2, 1, 100);
-        ImGui::SliderFloat("Gravity", &g_gravity, -30, 30);
+        // a sweep takes the other parameters from these controls when it starts
+        bool physical = false;
+        {
+            // presets run a kernel specialized on their constants
+            int preset = Presets::match(currentParams());
+            if (ImGui::BeginCombo("Preset", preset >= 0 ? Presets::name(preset) : "Custom"))
+            {
+                for (int p = 0; p < Presets::count; p++)
+                    if (ImGui::Selectable(Presets::name(p), p == preset))
+                    {
+                        SimParams values = currentParams();
+                        Presets::apply(p, values);
+                        g_l1 = values.l1; g_l2 = values.l2;
+                        g_m1 = values.m1; g_m2 = values.m2;
+                        g_gravity = values.gravity;
+                        physical = true;
+                    }
+                ImGui::EndCombo();
+            }
+        }
+        physical |= ImGui::SliderFloat("L1", &g_l1, 20, 300);
+        physical |= ImGui::SliderFloat("L2", &g_l2, 20, 300);
+        physical |= ImGui::SliderFloat("M1", &g_m1, 1, 100);
+        physical |= ImGui::SliderFloat("M2", &g_m2, 1, 100);
+        physical |= ImGui::SliderFloat("Gravity", &g_gravity, -30, 30);
+        if (physical && g_sweep.active() && !useChains())
+            initPendulums(g_count);
 
-        if (ImGui::SliderInt("Count", &g_count, 1, 500))
+        if (ImGui::SliderInt("Count", &g_count, 1, 100000, "%d", ImGuiSliderFlags_Logarithmic))
+            initPendulums(g_count);
+        if (ImGui::SliderInt("Links", &g_links, 2, ChainEnsemble::MAX_LINKS, "%d", ImGuiSliderFlags_Logarithmic))
             initPendulums(g_count);
+        if (useChains())
+            ImGui::TextDisabled("Chains always use float RK4");
+        if (ImGui::SliderInt("Threads", &g_threads, 1, ThreadPool::hardwareThreads()))
+            pool.resize(g_threads);
+
+        if (!useChains() && ImGui::CollapsingHeader("Parameter sweep"))
+        {
+            bool changed = false;
+            if (ImGui::BeginCombo("Parameter", sweep::parameterName(g_sweep.parameter)))
+            {
+                for (int p = 0; p < (int)sweep::Parameter::Count; p++)
+                    if (ImGui::Selectable(sweep::parameterName((sweep::Parameter)p), p == (int)g_sweep.parameter))
+                    {
+                        g_sweep.parameter = (sweep::Parameter)p;
+                        sweep::defaultRange(g_sweep.parameter, g_sweep.from, g_sweep.to);
+                        changed = true;
+                    }
+                ImGui::EndCombo();
+            }
+            if (g_sweep.active())
+            {
+                changed |= ImGui::SliderFloat("From", &g_sweep.from, 0.01f, 100.0f, "%.3g", ImGuiSliderFlags_Logarithmic);
+                changed |= ImGui::SliderFloat("To", &g_sweep.to, 0.01f, 100.0f, "%.3g", ImGuiSliderFlags_Logarithmic);
+                changed |= ImGui::Checkbox("Geometric spacing", &g_sweep.logarithmic);
+                ImGui::TextDisabled("Members start together, member 0 at From");
+            }
+            if (changed)
+                initPendulums(g_count);
+        }
+
+        if (!useChains() && ImGui::CollapsingHeader("Events"))
+        {
+            // the adaptive methods' steps are not checked for events
+            const bool adaptive = g_integrator == (int)Integrator::DormandPrince45
+                || g_integrator == (int)Integrator::Taylor;
+            if (adaptive)
+                ImGui::TextDisabled("Not with %s", integratorName((Integrator)g_integrator));
+            ImGui::BeginDisabled(adaptive);
+            for (int e = 0; e < (int)EventKind::Count; e++)
+            {
+                ImGui::PushID(e);
+                ImGui::CheckboxFlags(eventName((EventKind)e), &g_eventMask, eventBit((EventKind)e));
+                ImGui::SameLine(200);
+                ImGui::CheckboxFlags("retire", &g_retireMask, eventBit((EventKind)e));
+                ImGui::SameLine(280);
+                ImGui::Text("%llu", g_eventCounts[e]);
+                ImGui::PopID();
+            }
+            ImGui::EndDisabled();
+            ImGui::Text("Total: %llu, dropped: %llu", g_eventTotal, g_eventDropped);
+            ImGui::Text("Live: %d, retired: %d", pendulums.size(), (int)pendulums.retiredCount());
+        }
+
+        if (!useChains() && ImGui::CollapsingHeader("Energy drift"))
+        {
+            ImGui::Checkbox("Monitor", &g_energyMonitor);
+            ImGui::SliderInt("Every N steps", &g_energyInterval, 1, 1000, "%d", ImGuiSliderFlags_Logarithmic);
+            ImGui::SliderFloat("Threshold", &g_energyThreshold, 1e-8f, 1e-1f, "%.1e", ImGuiSliderFlags_Logarithmic);
+            if (g_energyMonitor)
+            {
+                EnergyStats st = pendulums.energyStats();
+                ImGui::Text("min %.2e  max %.2e  mean %.2e", st.minDrift, st.maxDrift, st.meanDrift);
+                ImGui::Text("worst %.2e, over threshold: %d", st.worstDrift, st.flagged);
+            }
+        }
+
+        if (!useChains() && ImGui::CollapsingHeader("Chaos indicators"))
+        {
+            const bool tangents = lyapunov::supports((Integrator)g_integrator);
+            ImGui::BeginDisabled(!tangents && !g_lyapunov);
+            ImGui::Checkbox("Lyapunov spectrum", &g_lyapunov);
+            ImGui::EndDisabled();
+            if (!tangents)
+                ImGui::TextDisabled("Not with %s", integratorName((Integrator)g_integrator));
+            ImGui::SliderInt("Orthonormalize every", &g_lyapunovInterval, 1, 1000, "%d steps", ImGuiSliderFlags_Logarithmic);
+            if (g_lyapunov)
+            {
+                ChaosStats st = pendulums.chaosStats();
+                ImGui::Text("spectrum %.3f %.3f %.3f %.3f", st.spectrum[0], st.spectrum[1], st.spectrum[2], st.spectrum[3]);
+                ImGui::Text("max exponent %.3f, mean MEGNO %.2f", st.maxExponent, st.megno);
+                ImGui::Text("chaotic: %d of %d, t = %.1f", st.chaotic, st.members, st.time);
+            }
+        }
+
+        if (!useChains() && ImGui::CollapsingHeader("Poincare section"))
+        {
+            static const char* directions[] = { "decreasing", "both", "increasing" };
+            bool changed = false;
+            if (ImGui::BeginCombo("Variable", poincare::variableName(g_sectionVariable)))
+            {
+                for (int v = -1; v < 4; v++)
+                    if (ImGui::Selectable(poincare::variableName(v), v == g_sectionVariable))
+                    {
+                        g_sectionVariable = v;
+                        g_sectionValue = 0.0f;
+                        // by default plot the arm that is not cut
+                        g_sectionPlotX = v == 1 || v == 3 ? 0 : 1;
+                        g_sectionPlotY = g_sectionPlotX + 2;
+                        changed = true;
+                    }
+                ImGui::EndCombo();
+            }
+            if (g_sectionVariable == 0 || g_sectionVariable == 1)
+                changed |= ImGui::SliderFloat("Value (from hanging)", &g_sectionValue, -PI, PI);
+            else if (g_sectionVariable >= 2)
+                changed |= ImGui::SliderFloat("Value", &g_sectionValue, -10.0f, 10.0f);
+            int direction = g_sectionDirection + 1;
+            if (ImGui::Combo("Crossing", &direction, directions, 3))
+            {
+                g_sectionDirection = direction - 1;
+                changed = true;
+            }
+            for (int axis = 0; axis < 2; axis++)
+            {
+                int& plot = axis == 0 ? g_sectionPlotX : g_sectionPlotY;
+                if (ImGui::BeginCombo(axis == 0 ? "Plot x" : "Plot y", poincare::variableName(plot)))
+                {
+                    for (int v = 0; v < 4; v++)
+                        if (ImGui::Selectable(poincare::variableName(v), v == plot))
+                        {
+                            plot = v;
+                            changed = true;
+                        }
+                    ImGui::EndCombo();
+                }
+            }
+            changed |= ImGui::SliderFloat("Rate range", &g_sectionRateRange, 0.1f, 100.0f, "%.1f", ImGuiSliderFlags_Logarithmic);
+            changed |= ImGui::SliderInt("Plot size", &g_sectionPlotSize, 64, 2048, "%d", ImGuiSliderFlags_Logarithmic);
+            if (ImGui::Button("Clear plot") || changed)
+                resetSectionPlot();
+
+            ImGui::InputText("Record to", g_sectionPath, sizeof(g_sectionPath));
+            if (!sectionStream.isOpen())
+            {
+                if (ImGui::Button("Record"))
+                    sectionStatus = sectionStream.open(g_sectionPath) ? "Recording" : "Could not open the file";
+            }
+            else if (ImGui::Button("Stop recording"))
+                sectionStatus = sectionStream.close() ? "Recorded" : "Write failed";
+            ImGui::SameLine();
+            ImGui::Text("%s", sectionStatus);
+            if (sectionStream.isOpen())
+                ImGui::Text("written %zu, dropped by the writer %zu",
+                    sectionStream.pointsWritten(), sectionStream.pointsDropped());
+            ImGui::Text("%.0f points/s, total %llu, dropped %llu", g_sectionRate, g_sectionTotal, g_sectionDropped);
+        }
+
+        if (ImGui::CollapsingHeader("Checkpoint"))
+        {
+            ImGui::InputText("File", g_checkpointPath, sizeof(g_checkpointPath));
+            if (ImGui::Button("Save"))
+                checkpointStatus = saveCheckpoint() ? "Saving..." : "Busy";
+            ImGui::SameLine();
+            if (ImGui::Button("Load"))
+            {
+                saver.wait();
+                checkpointStatus = loadCheckpoint(g_checkpointPath) ? "Loaded" : "Load failed";
+                resetSectionPlot();
+                simClock.reset(glfwGetTime());
+            }
+            ImGui::SliderFloat("Autosave (s)", &g_autosave, 0.0f, 3600.0f, "%.0f");
+            ImGui::Text("%s", checkpointStatus);
+        }
+
+        if (!useChains() && ImGui::CollapsingHeader("Flip-time map"))
+        {
+            ImGui::SliderInt("Map size", &g_flipMapSize, 64, 2048, "%d", ImGuiSliderFlags_Logarithmic);
+            ImGui::SliderFloat("Max time", &g_flipMapTime, 1.0f, 1000.0f, "%.0f s", ImGuiSliderFlags_Logarithmic);
+            if (ImGui::Button(g_flipMapRunning ? "Restart" : "Render"))
+                startFlipMap();
+            if (g_flipMapRunning)
+            {
+                ImGui::SameLine();
+                if (ImGui::Button("Stop")) g_flipMapRunning = false;
+            }
+            if (flipMapTexture)
+                ImGui::Text("%s, cells of %d px, %.1f%% of the pixels sampled",
+                    flipMap.done() ? "done" : g_flipMapRunning ? "refining" : "stopped",
+                    flipMap.cellSize(), 100.0 * flipMap.sampled() / flipMap.values().size());
+        }
 
         if (ImGui::Button("Reset"))
+        {
             initPendulums(g_count);
+            g_eventTotal = g_eventDropped = 0;
+            for (unsigned long long& c : g_eventCounts) c = 0;
+            g_sectionTotal = g_sectionDropped = rateTotal = 0;
+            resetSectionPlot();
+        }
         ImGui::End();
 
+        // --- Checkpoints ---
+        // the save runs in the background, it only has to be polled
+        switch (saver.poll())
+        {
+        case checkpoint::AsyncSaver::Status::Saved: checkpointStatus = "Saved"; break;
+        case checkpoint::AsyncSaver::Status::Failed: checkpointStatus = "Save failed"; break;
+        default: break;
+        }
+        if (g_autosave > 0.0f && glfwGetTime() - lastSave >= g_autosave)
+        {
+            lastSave = glfwGetTime();
+            if (saveCheckpoint()) checkpointStatus = "Saving...";
+        }
+
+        // --- Flip-time map ---
+        // refined a slice per frame, so it shows up coarse first and sharpens
+        if (g_flipMapRunning)
+            refineFlipMap(0.015);
+        if (flipMapTexture)
+        {
+            ImGui::SetNextWindowSize(ImVec2(420, 440), ImGuiCond_FirstUseEver);
+            ImGui::Begin("Flip-time map");
+            ImVec2 area = ImGui::GetContentRegionAvail();
+            float side = area.x < area.y ? area.x : area.y;
+            ImGui::Image((ImTextureID)(intptr_t)flipMapTexture, ImVec2(side, side));
+            ImGui::End();
+        }
+
+        // --- Poincare section ---
+        // the plot accumulates every crossing so far, redrawn once per frame
+        if (!useChains() && g_sectionVariable >= 0)
+        {
+            std::vector<unsigned char> pixels;
+            sectionPlot.image(pixels);
+            uploadGray(sectionTexture, sectionPlot.imageSize(), sectionPlot.imageSize(), pixels.data());
+            ImGui::SetNextWindowSize(ImVec2(420, 460), ImGuiCond_FirstUseEver);
+            ImGui::Begin("Poincare section");
+            ImGui::Text("%s across, %s (x) vs %s (y)", poincare::variableName(g_sectionVariable),
+                poincare::variableName(g_sectionPlotX), poincare::variableName(g_sectionPlotY));
+            ImVec2 area = ImGui::GetContentRegionAvail();
+            float side = area.x < area.y ? area.x : area.y;
+            ImGui::Image((ImTextureID)(intptr_t)sectionTexture, ImVec2(side, side));
+            ImGui::End();
+        }
+        if (glfwGetTime() - rateStart >= 1.0)
+        {
+            g_sectionRate = float((g_sectionTotal - rateTotal) / (glfwGetTime() - rateStart));
+            rateStart = glfwGetTime();
+            rateTotal = g_sectionTotal;
+        }
+
         // --- Simulation ---
-        for (auto& p : pendulums)
+        // published once per frame; everything below reads only this copy
+        paramsChannel.publish(currentParams());
+        const SimParams params = paramsChannel.latest();
+
+        simClock.step = g_timeStep;
+        simClock.timeScale = g_timeScale;
+        int steps = simClock.advance(glfwGetTime(), g_pause);
+        if (steps > 0)
+        {
+            float dt = g_reverse ? -g_timeStep : g_timeStep;
+            if (useChains())
+            {
+                if (steps > 1)
+                    chains.step(params, dt, steps - 1, pool);
+                chains.storePrevious();
+                chains.step(params, dt, 1, pool);
+            }
+            else
+            {
+                pendulums.setEventMask(g_eventMask);
+                pendulums.setRetireMask(g_retireMask);
+                pendulums.setEnergyMonitor(g_energyMonitor ? g_energyInterval : 0, g_energyThreshold);
+                pendulums.setLyapunov(g_lyapunov ? g_lyapunovInterval : 0);
+                pendulums.setSection(currentSection());
+                if (steps > 1)
+                    pendulums.step(params, dt, steps - 1, (Integrator)g_integrator, pool);
+                pendulums.storePrevious();
+                pendulums.step(params, dt, 1, (Integrator)g_integrator, pool);
+
+                const AppendBuffer<PendulumEvent>& events = pendulums.events();
+                for (const PendulumEvent& e : events)
+                    if (g_eventMask & eventBit(e.kind))
+                    {
+                        g_eventCounts[(int)e.kind]++;
+                        g_eventTotal++;
+                    }
+                g_eventDropped += events.dropped();
+                pendulums.clearEvents();
+                drainSection();
+            }
+        }
+
+        float cx = WIDTH / 2.0f;
+        float cy = HEIGHT / 2.0f;
+        float alpha = simClock.alpha();
+        if (useChains())
+        {
+            if (!g_pause)
+                chains.updateTrails(cx, cy, alpha, params);
+            chains.draw(cx, cy, alpha, params);
+        }
+        else
         {
-			float dt = g_reverse ? -0.01f : 0.01f;
-			for (int i = 0; i < 5; i++)
-                p.updateMotionRK4(dt);
-            float cx = WIDTH / 2.0f;
-            float cy = HEIGHT / 2.0f;
-            float x = cx + g_l1 * sin(p.theta1) + g_l2 * sin(p.theta2);
-            float y = cy - g_l1 * cos(p.theta1) - g_l2 * cos(p.theta2);
-            p.updateTrail(x, y);
-            p.draw(cx, cy);
+            if (!g_pause)
+                pendulums.updateTrails(cx, cy, alpha, params);
+            pendulums.draw(cx, cy, alpha, params);
         }
 
         // --- Render ImGui ---
@@ -130,6 +1052,10 @@ int main()
         glfwSwapBuffers(window);
     }
 
+    saver.wait();
+    sectionStream.close();
+    if (flipMapTexture) glDeleteTextures(1, &flipMapTexture);
+    if (sectionTexture) glDeleteTextures(1, &sectionTexture);
     ImGui_ImplOpenGL2_Shutdown();
     ImGui_ImplGlfw_Shutdown();
     ImGui::DestroyContext();